@@ -20,6 +20,8 @@
  */
 
 #include "DynamicHID.h"
+#include "MemoryMonitor.h"
+#include "Profiler.h"
 
 #if defined(USBCON)
 
@@ -71,7 +73,19 @@ int DynamicHID_::getDescriptor(USBSetup& setup) {
   return total;
 }
 
+// USB serial number. With a unique id saved it is "RG" and the id in hex, so host software
+// can tell guns apart at enumeration without asking each COM port
 uint8_t DynamicHID_::getShortName(char* name) {
+  uint16_t uniqueId = DeviceEEPROM::loadUniqueId();
+  if (uniqueId) {
+    name[0] = 'R';
+    name[1] = 'G';
+    for (uint8_t i = 0; i < 4; i++) {
+      uint8_t digit = (uniqueId >> (12 - 4 * i)) & 0x0F;
+      name[2 + i] = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    }
+    return 6;
+  }
   name[0] = 'H';
   name[1] = 'I';
   name[2] = 'D';
@@ -96,6 +110,7 @@ void DynamicHID_::AppendDescriptor(DynamicHIDSubDescriptor* node) {
 
 int DynamicHID_::SendReport(uint8_t id, const void* data, int len) {
   uint8_t p[len + 1];
+  memoryMonitor.vla(len + 1);
   p[0] = id;
   memcpy(&p[1], data, len);
   return USB_Send(PID_ENDPOINT_IN | TRANSFER_RELEASE, p, len + 1);
@@ -113,11 +128,37 @@ void DynamicHID_::RecvfromUsb() {
   if (usb_Available() > 0) {
     uint16_t len = USB_Recv(PID_ENDPOINT_OUT, &out_ffbdata, 64);
     if (len >= 0) {
+      PROFILE_START(unpackStart);
       pidReportHandler.UppackUsbData(out_ffbdata, len);
+      PROFILE_END(unpackStart, PROFILE_USB_OUT);
     }
   }
 }
 
+// Number of the last USB start of frame, 1 ms apart on a full speed bus
+uint16_t DynamicHID_::frameNumber() {
+#ifdef UDFNUML
+  uint16_t frame = UDFNUML;
+  frame |= (uint16_t)UDFNUMH << 8;
+  return frame;
+#else
+  return millis();
+#endif
+}
+
+// Push the PID state to the host when an effect starts, stops or the device pauses,
+// so drivers don't have to poll for it. A burst of changes goes out as one report per USB frame.
+void DynamicHID_::SendPIDState() {
+  if (!pidReportHandler.pidStateChanged)
+    return;
+  uint16_t frame = frameNumber();
+  if (frame == pidStateFrame)
+    return;
+  pidStateFrame = frame;
+  pidReportHandler.pidStateChanged = false;
+  SendReport(2, pidReportHandler.getPIDStatus() + 1, sizeof(USB_FFBReport_PIDStatus_Input_Data_t) - 1);
+}
+
 bool DynamicHID_::GetReport(USBSetup& setup) {
   uint8_t report_id = setup.wValueL;
   uint8_t report_type = setup.wValueH;
@@ -175,6 +216,7 @@ bool DynamicHID_::SetReport(USBSetup& setup) {
 		  return true;
 		  }*/
   }
+  return (false);
 }
 
 bool DynamicHID_::setup(USBSetup& setup) {
@@ -221,7 +263,7 @@ bool DynamicHID_::setup(USBSetup& setup) {
 
 DynamicHID_::DynamicHID_(void)
   : PluggableUSBModule(PID_ENPOINT_COUNT, 1, epType),
-    rootNode(NULL), descriptorSize(0),
+    rootNode(NULL), descriptorSize(0), pidStateFrame(0xFFFF),
     protocol(DYNAMIC_HID_REPORT_PROTOCOL), idle(1) {
   epType[0] = EP_TYPE_INTERRUPT_IN;
   epType[1] = EP_TYPE_INTERRUPT_OUT;
@@ -122,6 +122,8 @@ public:
   int SendReport(uint8_t id, const void* data, int len);
   int RecvData(byte* data);
   void RecvfromUsb();
+  void SendPIDState();
+  uint16_t frameNumber();
   void AppendDescriptor(DynamicHIDSubDescriptor* node);
   PIDReportHandler pidReportHandler;
 
@@ -139,6 +141,7 @@ private:
   uint8_t out_ffbdata[64];
   DynamicHIDSubDescriptor* rootNode;
   uint16_t descriptorSize;
+  uint16_t pidStateFrame;
 
   uint8_t protocol;
   uint8_t idle;
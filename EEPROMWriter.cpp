@@ -0,0 +1,74 @@
+#include "EEPROMWriter.h"
+#include <avr/eeprom.h>
+
+EEPROMWriter eepromWriter;
+
+ISR(EE_READY_vect) {
+  eepromWriter.service();
+}
+
+EEPROMWriter::EEPROMWriter() {
+  block = NULL;
+  source = NULL;
+  address = 0;
+  remaining = 0;
+}
+
+void EEPROMWriter::write(uint16_t newAddress, const void* data, uint16_t length) {
+  uint8_t oldSREG = SREG;
+  cli();
+  block = data;
+  source = (const uint8_t*)data;
+  address = newAddress;
+  remaining = length;
+  //the interrupt fires as soon as no byte is being programmed
+  EECR |= (1 << EERIE);
+  SREG = oldSREG;
+}
+
+bool EEPROMWriter::busy() {
+  //stays set until the last byte has finished programming
+  return EECR & (1 << EERIE);
+}
+
+bool EEPROMWriter::busy(const void* data) {
+  return busy() && block == data;
+}
+
+//the EE_READY interrupt sets EEAR for its own byte, so a read it lands in the middle of gets the wrong address.
+//each byte is read with interrupts off, but only once no byte is programming so they are never off for long
+uint8_t EEPROMWriter::read(uint16_t address) {
+  for (;;) {
+    while (EECR & (1 << EEPE)) {}
+    uint8_t oldSREG = SREG;
+    cli();
+    if (!(EECR & (1 << EEPE))) {
+      uint8_t value = eeprom_read_byte((const uint8_t*)address);
+      SREG = oldSREG;
+      return value;
+    }
+    SREG = oldSREG;
+  }
+}
+
+void EEPROMWriter::read(uint16_t address, void* data, uint16_t length) {
+  for (uint16_t i = 0; i < length; i++) {
+    ((uint8_t*)data)[i] = read(address + i);
+  }
+}
+
+void EEPROMWriter::service() {
+  while (remaining && eeprom_read_byte((const uint8_t*)address) == *source) {
+    address++;
+    source++;
+    remaining--;
+  }
+  if (!remaining) {
+    EECR &= ~(1 << EERIE);
+    return;
+  }
+  eeprom_write_byte((uint8_t*)address, *source);
+  address++;
+  source++;
+  remaining--;
+}
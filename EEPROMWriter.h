@@ -0,0 +1,29 @@
+#ifndef EEPROMWRITER_h
+#define EEPROMWRITER_h
+
+#include <Arduino.h>
+
+//writes a block to EEPROM in the background, one byte per EE_READY interrupt.
+//bytes that already hold the new value are skipped and the block is written in address order,
+//so a record whose check byte comes last is never valid half written.
+//the source has to stay untouched until busy() is false, a new write() restarts from the first byte
+class EEPROMWriter {
+public:
+  EEPROMWriter();
+  void write(uint16_t address, const void* data, uint16_t length);
+  bool busy();
+  bool busy(const void* data);  //busy writing the block at data
+  void service();  //from the EE_READY interrupt
+  static uint8_t read(uint16_t address);  //safe while the interrupt writes
+  static void read(uint16_t address, void* data, uint16_t length);
+
+private:
+  const void* block;
+  const uint8_t* volatile source;
+  volatile uint16_t address;
+  volatile uint16_t remaining;
+};
+
+extern EEPROMWriter eepromWriter;
+
+#endif  // EEPROMWRITER_h
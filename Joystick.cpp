@@ -21,6 +21,11 @@
 
 #include "Joystick.h"
 #include "PIDDescriptor.h"
+#include "Profiler.h"
+#include "MemoryMonitor.h"
+#ifdef LATENCY_TEST
+#include <digitalWriteFast.h>
+#endif
 #if defined(_USING_DYNAMIC_HID)
 
 #define JOYSTICK_REPORT_ID_INDEX 7
@@ -431,6 +436,38 @@ Joystick_::Joystick_(
     tempHidReportDescriptor[hidReportDescriptorSize++] = 0xc0;
   }  // Simulation Controls
 
+#ifdef LATENCY_TEST
+  // USAGE_PAGE (Vendor Defined 0xFF00)
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x06;
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x00;
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0xFF;
+
+  // USAGE (Vendor Usage 1)
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x09;
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x01;
+
+  // LOGICAL_MINIMUM (0)
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x15;
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x00;
+
+  // LOGICAL_MAXIMUM (255)
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x26;
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0xFF;
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x00;
+
+  // REPORT_SIZE (8)
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x75;
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x08;
+
+  // REPORT_COUNT (7) sequence id, capture to send time in us, micros() at send
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x95;
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x07;
+
+  // INPUT (Data,Var,Abs)
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x81;
+  tempHidReportDescriptor[hidReportDescriptorSize++] = 0x02;
+#endif
+
   // END_COLLECTION
   tempHidReportDescriptor[hidReportDescriptorSize++] = 0xc0;
 
@@ -456,6 +493,9 @@ Joystick_::Joystick_(
   _hidReportSize += (_hatSwitchCount > 0);
   _hidReportSize += (axisCount * 2);
   _hidReportSize += (simulationCount * 2);
+#ifdef LATENCY_TEST
+  _hidReportSize += 7;
+#endif
   _hidReportSize += (sizeof(ammoCount));
   _hidReportSize += (sizeof(useAmmoCount));
 
@@ -489,6 +529,10 @@ void Joystick_::begin(bool initAutoSendState) {
 
 void Joystick_::getUSBPID() {
   DynamicHID().RecvfromUsb();
+  if (DynamicHID().pidReportHandler.EffectTick()) {
+    pressFire(true, false);
+  }
+  DynamicHID().SendPIDState();
   processUsbCmd();
 }
 
@@ -516,6 +560,157 @@ void Joystick_::setTriggerHoldTime(uint16_t value) {
   triggerHoldTime = value;
 }
 
+void Joystick_::setFfbRecoil(uint8_t mode, int16_t threshold, int16_t minPeriod) {
+  FfbRecoilSettings *ffbRecoil = &DynamicHID().pidReportHandler.ffbRecoil;
+  ffbRecoil->mode = mode;
+  ffbRecoil->threshold = threshold;
+  ffbRecoil->minPeriod = max(minPeriod, 0);
+}
+
+uint16_t Joystick_::getRecoilOnTime() {
+  return recoilPulse.onTime;
+}
+
+uint16_t Joystick_::getRecoilOffTime() {
+  return recoilPulse.offTime;
+}
+
+void Joystick_::setRecoilPulse(uint16_t onTime, uint16_t offTime) {
+  recoilPulse.onTime = onTime;
+  recoilPulse.offTime = offTime;
+}
+
+//the steps of the active pattern, the plain pulse is one full duty step
+RecoilPattern Joystick_::getRecoilPattern() {
+  RecoilPattern pattern;
+  if (recoilPattern == RECOIL_PATTERN_PULSE) {
+    memset(&pattern, 0, sizeof(pattern));
+    pattern.steps[0].duty = RECOIL_DUTY_FULL;
+    pattern.steps[0].time = recoilPulse.onTime;
+    pattern.shots = 1;
+  } else {
+    pattern = recoilPatterns[recoilPattern - 1];
+  }
+  return pattern;
+}
+
+bool Joystick_::setRecoilPattern(uint8_t pattern) {
+  if (pattern > RECOIL_PATTERN_COUNT) {
+    return false;
+  }
+  recoilPattern = pattern;
+  return true;
+}
+
+bool Joystick_::setRecoilStep(uint8_t pattern, uint8_t step, uint8_t duty, uint16_t time) {
+  if (pattern == RECOIL_PATTERN_PULSE || pattern > RECOIL_PATTERN_COUNT || step >= RECOIL_PATTERN_STEPS) {
+    return false;
+  }
+  recoilPatterns[pattern - 1].steps[step].duty = duty;
+  recoilPatterns[pattern - 1].steps[step].time = time;
+  return true;
+}
+
+bool Joystick_::setRecoilShots(uint8_t pattern, uint8_t shots) {
+  if (pattern == RECOIL_PATTERN_PULSE || pattern > RECOIL_PATTERN_COUNT) {
+    return false;
+  }
+  recoilPatterns[pattern - 1].shots = max(shots, 1);
+  return true;
+}
+
+bool Joystick_::setSetting(uint8_t id, int16_t value) {
+  FfbRecoilSettings *ffbRecoil = &DynamicHID().pidReportHandler.ffbRecoil;
+  switch (id) {
+    case SETTING_X_AXIS_MINIMUM:
+      _xAxisMinimum = value;
+      break;
+    case SETTING_X_AXIS_MAXIMUM:
+      _xAxisMaximum = value;
+      break;
+    case SETTING_Y_AXIS_MINIMUM:
+      _yAxisMinimum = value;
+      break;
+    case SETTING_Y_AXIS_MAXIMUM:
+      _yAxisMaximum = value;
+      break;
+    case SETTING_AUTO_RECOIL:
+      autoRecoil = value ? true : false;
+      break;
+    case SETTING_TRIGGER_REPEAT_RATE:
+      triggerRepeatRate = value;
+      break;
+    case SETTING_TRIGGER_HOLD_TIME:
+      triggerHoldTime = value;
+      break;
+    case SETTING_FFB_RECOIL_MODE:
+      ffbRecoil->mode = value;
+      break;
+    case SETTING_FFB_RECOIL_THRESHOLD:
+      ffbRecoil->threshold = value;
+      break;
+    case SETTING_FFB_RECOIL_MIN_PERIOD:
+      ffbRecoil->minPeriod = max(value, 0);
+      break;
+    case SETTING_RECOIL_ON_TIME:
+      recoilPulse.onTime = (uint16_t)value;
+      break;
+    case SETTING_RECOIL_OFF_TIME:
+      recoilPulse.offTime = (uint16_t)value;
+      break;
+    case SETTING_RECOIL_PATTERN:
+      return setRecoilPattern(value);
+    case SETTING_RECOIL_HEAT_LIMIT:
+      recoilThermal.settings.heatLimit = (uint16_t)value;
+      break;
+    case SETTING_RECOIL_COOLING_TIME:
+      recoilThermal.settings.coolingTime = (uint16_t)value;
+      break;
+    case SETTING_PROFILE:
+      return setProfile(value);
+    default:
+      return false;
+  }
+  return true;
+}
+
+//applies every TLV entry or none of them, returns the number applied or -1
+int8_t Joystick_::applyBatch(const uint8_t *data, uint8_t length) {
+  Settings before = getSettings();
+  uint8_t profileBefore = activeProfile;
+  int8_t count = 0;
+  uint8_t i = 0;
+  while (i < length) {
+    uint8_t id = data[i++];
+    if (id == 0) {
+      continue;
+    }
+    if (i >= length) {
+      count = -1;
+      break;
+    }
+    uint8_t size = data[i++];
+    if ((size != 1 && size != 2) || i + size > length) {
+      count = -1;
+      break;
+    }
+    int16_t value = size == 1 ? data[i] : (int16_t)(data[i] | (data[i + 1] << 8));
+    i += size;
+    if (!setSetting(id, value)) {
+      count = -1;
+      break;
+    }
+    count++;
+  }
+  if (count < 0) {
+    //roll back, a profile switch in the batch has to be undone first
+    activeProfile = profileBefore;
+    loadSettings(before);
+    return -1;
+  }
+  return count;
+}
+
 void Joystick_::sendGuiReport(void *data) {
   //return settings and firmware version
   strcpy_P(((Settings *)data)->id, PSTR(FIRMWARE_TYPE));
@@ -531,6 +726,9 @@ void Joystick_::sendGuiReport(void *data) {
 }
 
 void Joystick_::loadSettings(Settings settings) {
+  //the Timer3 interrupt reads the recoil and FFB settings, it must not see half of a profile switch
+  uint8_t oldSREG = SREG;
+  cli();
   _xAxisMinimum = settings.xAxisMinimum;
   _xAxisMaximum = settings.xAxisMaximum;
   _yAxisMinimum = settings.yAxisMinimum;
@@ -538,14 +736,39 @@ void Joystick_::loadSettings(Settings settings) {
   autoRecoil = settings.autoRecoil;
   triggerRepeatRate = settings.triggerRepeatRate;
   triggerHoldTime = settings.triggerHoldTime;
+  DynamicHID().pidReportHandler.ffbRecoil = settings.ffbRecoil;
+  recoilPulse = settings.recoilPulse;
+  recoilPattern = settings.recoilPattern;
+  memcpy(recoilPatterns, settings.recoilPatterns, sizeof(recoilPatterns));
+  recoilThermal.settings = settings.recoilThermal;
+  SREG = oldSREG;
+}
+
+void Joystick_::loadProfiles() {
+  uniqueId = DeviceEEPROM::loadUniqueId();
+  settingsEEPROM.begin();
+  loadSettings(settingsEEPROM.load(activeProfile));
 }
 
 void Joystick_::loadSettings() {
-  Settings settings = eeprom.load(false);
-  loadSettings(settings);
+  loadSettings(settingsEEPROM.load(activeProfile));
+}
+
+//unsaved changes to the profile left behind are dropped, like loading it again
+bool Joystick_::setProfile(uint8_t profile) {
+  if (profile >= SETTINGS_PROFILES) {
+    return false;
+  }
+  activeProfile = profile;
+  loadSettings(settingsEEPROM.load(profile));
+  return true;
 }
 
-void Joystick_::saveSettings() {
+uint8_t Joystick_::getProfile() {
+  return activeProfile;
+}
+
+Settings Joystick_::getSettings() {
   Settings settings;
   strcpy_P(settings.id, PSTR(FIRMWARE_TYPE));
   strcpy_P(settings.ver, PSTR(FIRMWARE_VERSION));
@@ -556,11 +779,20 @@ void Joystick_::saveSettings() {
   settings.autoRecoil = autoRecoil;
   settings.triggerRepeatRate = triggerRepeatRate;
   settings.triggerHoldTime = triggerHoldTime;
-  eeprom.save(settings);
+  settings.ffbRecoil = DynamicHID().pidReportHandler.ffbRecoil;
+  settings.recoilPulse = recoilPulse;
+  settings.recoilPattern = recoilPattern;
+  memcpy(settings.recoilPatterns, recoilPatterns, sizeof(recoilPatterns));
+  settings.recoilThermal = recoilThermal.settings;
+  return settings;
+}
+
+bool Joystick_::saveSettings() {
+  return settingsEEPROM.save(activeProfile, getSettings());
 }
 
 void Joystick_::loadDefaultSettings() {
-  loadSettings(eeprom.getDefaults());
+  loadSettings(SettingsEEPROM::getDefaults());
 }
 
 /*
@@ -568,6 +800,17 @@ void Joystick_::loadDefaultSettings() {
 */
 void Joystick_::processUsbCmd() {
   USB_GUI_Command *usbCmd = &DynamicHID().pidReportHandler.usbCommand;
+  if (uniqueIdChanged && device.saveUniqueId(uniqueId)) {
+    uniqueIdChanged = false;
+  }
+  if (saveReplyPending && !settingsEEPROM.saving()) {
+    //command 16 is answered once its bytes are in EEPROM, arg 1 = saved
+    saveReplyPending = false;
+    memset((void *)&USB_GUI_Report, 0, sizeof(USB_GUI_Report));
+    USB_GUI_Report.command = 16;
+    USB_GUI_Report.arg = 1;
+    sendGuiReport(USB_GUI_Report.data);
+  }
   if (usbCmd->command) {
     /*Serial.print(usbCmd->command);
     Serial.print(":");
@@ -614,14 +857,77 @@ void Joystick_::processUsbCmd() {
         triggerHoldTime = usbCmd->arg[0];
         sendGuiReport(data);
         break;
-      case 6:  //set uniqueId, useful for matching com port to hid device
-        uniqueId = usbCmd->arg[0];
+      case 6:  //set uniqueId, useful for matching com port to hid device, saved and used as usb serial number
+        setUniqueId(usbCmd->arg[0]);
+        break;
+      case 7:  //set ffb recoil mapping, replies with the resulting mapping
+        setFfbRecoil(usbCmd->arg[0], usbCmd->arg[1], usbCmd->arg[2]);
+        memcpy(data, &DynamicHID().pidReportHandler.ffbRecoil, sizeof(FfbRecoilSettings));
+        DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
+        break;
+      case 8:  //set recoil on and off time in us, replies with the resulting pulse
+        setRecoilPulse(usbCmd->arg[0], usbCmd->arg[1]);
+        memcpy(data, &recoilPulse, sizeof(RecoilPulseSettings));
+        DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
         break;
-      case 16:  //save settings to eeprom
-        saveSettings();
+      case 9:  //set a recoil pattern step: pattern, step, duty, time in us, replies with the pattern
+        setRecoilStep(usbCmd->arg[0], usbCmd->arg[1], usbCmd->arg[2], usbCmd->arg[3]);
+        memcpy(data, &recoilPatterns[constrain(usbCmd->arg[0], 1, RECOIL_PATTERN_COUNT) - 1], sizeof(RecoilPattern));
+        DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
+        break;
+      case 10:  //set the shots in a recoil pattern burst: pattern, shots, replies with the pattern
+        setRecoilShots(usbCmd->arg[0], usbCmd->arg[1]);
+        memcpy(data, &recoilPatterns[constrain(usbCmd->arg[0], 1, RECOIL_PATTERN_COUNT) - 1], sizeof(RecoilPattern));
+        DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
+        break;
+      case 11:  //select the recoil pattern, 0 is the plain pulse, replies with the active pattern in arg
+        setRecoilPattern(usbCmd->arg[0]);
+        USB_GUI_Report.arg = recoilPattern;
+        DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
+        break;
+      case 13:  //set the thermal model: heat limit in ms, cooling time in s
+        recoilThermal.settings.heatLimit = usbCmd->arg[0];
+        recoilThermal.settings.coolingTime = usbCmd->arg[1];
+        //fall through
+      case 12:  //get the solenoid thermal state, load in % of the limit in arg
+        {
+          uint32_t heat = recoilThermal.getHeat();
+          uint16_t scale = recoilThermal.scale();
+          USB_GUI_Report.arg = recoilThermal.getLoad();
+          memcpy(data, &heat, sizeof(heat));
+          memcpy((uint8_t *)data + 4, &scale, sizeof(scale));
+          memcpy((uint8_t *)data + 6, &recoilThermal.settings, sizeof(RecoilThermalSettings));
+          DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
+        }
+        break;
+      case 14:  //get loop task stats: task index, reset all after reading when arg[1] > 0, task count in arg
+        {
+          LoopTaskStats stats;
+          USB_GUI_Report.arg = loopScheduler ? loopScheduler->getTaskCount() : 0;
+          if (loopScheduler && loopScheduler->getStats(usbCmd->arg[0], &stats)) {
+            memcpy(data, &stats, sizeof(stats));
+          }
+          if (loopScheduler && usbCmd->arg[1] > 0) {
+            loopScheduler->resetStats();
+          }
+          DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
+        }
+        break;
+      case 15:  //switch to a settings profile, replies with its settings and the active profile in arg
+        setProfile(usbCmd->arg[0]);
+        USB_GUI_Report.arg = activeProfile;
         sendGuiReport(data);
         break;
-      case 17:  //save settings to eeprom
+      case 16:  //save settings to the active profile in eeprom, replies when the write is done
+        if (saveSettings()) {
+          saveReplyPending = true;
+        } else {
+          //another profile is still being written, arg 0 = not saved
+          USB_GUI_Report.arg = 0;
+          sendGuiReport(data);
+        }
+        break;
+      case 17:  //load the active profile from eeprom
         loadSettings();
         sendGuiReport(data);
         break;
@@ -634,6 +940,62 @@ void Joystick_::processUsbCmd() {
           pressFire(true, false);
         }
         break;
+      case 20:  //set ammo count
+        setAmmoCount(usbCmd->arg[0]);
+        break;
+      case 21:  //set health
+        setHealth(usbCmd->arg[0]);
+        break;
+      case 22:  //set max health
+        setMaxHealth(usbCmd->arg[0]);
+        sendUpdate = true;
+        break;
+      case 23:  //use ammo count on/off
+        setUseAmmoCount(usbCmd->arg[0] > 0);
+        break;
+      case 24:  //get uniqueId, same as the getuniqueid serial command
+        USB_GUI_Report.arg = uniqueId;
+        DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
+        break;
+      case 25:  //append the arg bytes to the settings batch
+        if (batchLength != GUI_BATCH_OVERFLOW) {
+          if (batchLength + sizeof(usbCmd->arg) > GUI_BATCH_SIZE) {
+            batchLength = GUI_BATCH_OVERFLOW;
+          } else {
+            memcpy(&batch[batchLength], usbCmd->arg, sizeof(usbCmd->arg));
+            batchLength += sizeof(usbCmd->arg);
+          }
+        }
+        break;
+      case 26:  //apply the settings batch at once, replies with the settings and the entries applied in arg, -1 when none were
+        USB_GUI_Report.arg = batchLength == GUI_BATCH_OVERFLOW ? -1 : applyBatch(batch, batchLength);
+        batchLength = 0;
+        sendGuiReport(data);
+        break;
+      case 27:  //get a profiler histogram: stage index, reset all after reading when arg[1] > 0, stage count in arg, 0 when built without the profiler
+        USB_GUI_Report.arg = 0;
+#ifdef PROFILER_ENABLED
+        {
+          ProfileHistogram histogram;
+          USB_GUI_Report.arg = PROFILE_STAGES;
+          if (profiler.getHistogram(usbCmd->arg[0], &histogram)) {
+            memcpy(data, &histogram, sizeof(histogram));
+          }
+          if (usbCmd->arg[1] > 0) {
+            profiler.reset();
+          }
+        }
+#endif
+        DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
+        break;
+      case 28:  //get SRAM use: free stack now and at its deepest, heap used and free, largest VLA
+        {
+          MemoryStats stats;
+          memoryMonitor.getStats(&stats);
+          memcpy(data, &stats, sizeof(stats));
+          DynamicHID().SendReport(16, &USB_GUI_Report, sizeof(USB_GUI_Report));
+        }
+        break;
     }
   }
 
@@ -693,14 +1055,20 @@ bool Joystick_::getUseAmmoCount() {
   return useAmmoCount;
 }
 
+//saved by processUsbCmd once the EEPROM is free, the USB serial number changes on the next enumeration
 void Joystick_::setUniqueId(uint16_t id) {
   uniqueId = id;
+  uniqueIdChanged = true;
 }
 
 uint16_t Joystick_::getUniqueId() {
   return uniqueId;
 }
 
+void Joystick_::setLoopScheduler(LoopScheduler* scheduler) {
+  loopScheduler = scheduler;
+}
+
 void Joystick_::setButton(uint8_t button, uint8_t value) {
   if (value == 0) {
     releaseButton(button);
@@ -714,7 +1082,11 @@ void Joystick_::pressButton(uint8_t button) {
   int index = button / 8;
   int bit = button % 8;
 
+  //the recoil interrupts press and release the trigger too, so the read-modify-write can't be split
+  uint8_t oldSREG = SREG;
+  cli();
   bitSet(_buttonValues[index], bit);
+  SREG = oldSREG;
   if (_autoSendState) sendState();
 }
 void Joystick_::releaseButton(uint8_t button) {
@@ -723,7 +1095,10 @@ void Joystick_::releaseButton(uint8_t button) {
   int index = button / 8;
   int bit = button % 8;
 
+  uint8_t oldSREG = SREG;
+  cli();
   bitClear(_buttonValues[index], bit);
+  SREG = oldSREG;
   if (_autoSendState) sendState();
 }
 
@@ -828,6 +1203,7 @@ int Joystick_::buildAndSetSimulationValue(bool includeValue, int16_t value, int1
 
 void Joystick_::sendState() {
   uint8_t data[_hidReportSize];
+  memoryMonitor.vla(_hidReportSize);
   int index = 0;
 
   // Load Button State
@@ -873,7 +1249,51 @@ void Joystick_::sendState() {
   //index += buildAndSetSimulationValue(_includeSimulatorFlags & JOYSTICK_INCLUDE_BRAKE, _brake, _brakeMinimum, _brakeMaximum, &(data[index]));
   //index += buildAndSetSimulationValue(_includeSimulatorFlags & JOYSTICK_INCLUDE_STEERING, _steering, _steeringMinimum, _steeringMaximum, &(data[index]));
 
+#ifdef LATENCY_TEST
+  //GUI command 1 sends the state from the Timer3 interrupt, the capture must not change halfway
+  uint8_t oldSREG = SREG;
+  cli();
+  bool captured = latencyPending;
+  unsigned long sentAt = micros();
+  uint16_t latency = captured ? sentAt - latencyCapture : 0;
+  if (captured) {
+    latencySequence++;
+    latencyPending = false;
+  }
+  data[index++] = latencySequence;
+  SREG = oldSREG;
+  index += set16BitValue(latency, &(data[index]));
+  index += set16BitValue(sentAt, &(data[index]));
+  index += set16BitValue(sentAt >> 16, &(data[index]));
+#endif
+
   DynamicHID().SendReport(_hidReportId, data, _hidReportSize);
+
+#ifdef LATENCY_TEST
+  if (captured) {
+    oldSREG = SREG;
+    cli();
+    //an input captured while sending keeps the pin high for the next report
+    if (!latencyPending) {
+      digitalWriteFast(LATENCY_TEST_PIN, LOW);
+    }
+    SREG = oldSREG;
+  }
+#endif
+}
+
+#ifdef LATENCY_TEST
+//a button edge or axis step was read, the next report carries it
+void Joystick_::inputCaptured() {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (!latencyPending) {
+    latencyCapture = micros();
+    latencyPending = true;
+    digitalWriteFast(LATENCY_TEST_PIN, HIGH);
+  }
+  SREG = oldSREG;
 }
+#endif
 
 #endif
@@ -24,6 +24,8 @@
 
 #include "DynamicHID.h"
 #include "Settings.h"
+#include "RecoilThermal.h"
+#include "LoopScheduler.h"
 
 #if ARDUINO < 10606
 #error The Joystick library requires Arduino IDE 1.6.6 or greater. Please update your IDE.
@@ -55,11 +57,17 @@
 #define JOYSTICK_TYPE_GAMEPAD 0x05
 #define JOYSTICK_TYPE_MULTI_AXIS 0x08
 
+//batched settings: command 25 appends the 8 arg bytes of each report to the batch,
+//command 26 applies it. entries are SETTING_* id, length 1 or 2, little endian value, id 0 is padding
+#define GUI_BATCH_SIZE 64
+#define GUI_BATCH_OVERFLOW 0xFF
+
 #define DIRECTION_ENABLE 0x04
 #define X_AXIS_ENABLE 0x01
 #define Y_AXIS_ENABLE 0x02
 
 void pressFire(bool doRecoil, bool setButton);
+extern volatile bool sendUpdate;  //in the sketch, loop() sends the joystick state when set
 
 class Joystick_ {
 private:
@@ -92,8 +100,12 @@ private:
   int16_t maxHealth = 1000;
   bool useAmmoCount = false;
   uint16_t uniqueId = 0;
+  bool uniqueIdChanged = false;  //still to be saved
   int16_t triggerRepeatRate = 100;
   int16_t triggerHoldTime = 500;
+  RecoilPulseSettings recoilPulse = { RECOIL_RELEASE_MS * 1000U, RECOIL_MS * 1000U };
+  uint8_t recoilPattern = RECOIL_PATTERN_PULSE;
+  RecoilPattern recoilPatterns[RECOIL_PATTERN_COUNT];
   int16_t _xAxisMinimum = JOYSTICK_DEFAULT_AXIS_MINIMUM;  //14;
   int16_t _xAxisMaximum = JOYSTICK_DEFAULT_AXIS_MAXIMUM;  //932;
   int16_t _yAxisMinimum = JOYSTICK_DEFAULT_AXIS_MINIMUM;  //91;
@@ -121,7 +133,18 @@ private:
   uint8_t _hidReportSize;
 
   GUI_Report USB_GUI_Report;
-  SettingsEEPROM eeprom;
+  SettingsEEPROM settingsEEPROM;
+  uint8_t activeProfile = 0;
+  DeviceEEPROM device;
+  bool saveReplyPending = false;  //command 16 is answered once the save is done
+  uint8_t batch[GUI_BATCH_SIZE];  //TLV settings collected by command 25
+  uint8_t batchLength = 0;        //GUI_BATCH_OVERFLOW once more than GUI_BATCH_SIZE bytes arrived
+  LoopScheduler* loopScheduler = NULL;
+#ifdef LATENCY_TEST
+  uint8_t latencySequence = 0;  //reports sent with a captured input
+  volatile bool latencyPending = false;  //an input was captured since the last report
+  unsigned long latencyCapture;
+#endif
 
 protected:
   int set16BitValue(int16_t value, uint8_t dataLocation[]);
@@ -132,6 +155,8 @@ protected:
   int buildAndSetSimulationValue(bool includeValue, int16_t value, int16_t valueMinimum, int16_t valueMaximum, uint8_t dataLocation[]);
 
 public:
+  RecoilThermal recoilThermal;
+
   Joystick_(
     uint8_t hidReportId = JOYSTICK_DEFAULT_REPORT_ID,
     uint8_t joystickType = JOYSTICK_TYPE_JOYSTICK,
@@ -219,21 +244,39 @@ public:
   void setHatSwitch(int8_t hatSwitch, int16_t value);
 
   void sendState();
+  void setLoopScheduler(LoopScheduler* scheduler);  //its task stats are GUI command 14
+#ifdef LATENCY_TEST
+  void inputCaptured();
+#endif
   void sendGuiReport(void* data);
   // get USB PID data
   void getUSBPID();
 
   void processUsbCmd();
+  void loadProfiles();
   void loadSettings();
-  void saveSettings();
+  Settings getSettings();
+  bool saveSettings();
   void loadDefaultSettings();
   void loadSettings(Settings settings);
+  bool setProfile(uint8_t profile);
+  uint8_t getProfile();
   bool getAutoRecoil();
   void setAutoRecoil(bool value);
   uint16_t getTriggerRepeatRate();
   void setTriggerRepeatRate(uint16_t value);
   uint16_t getTriggerHoldTime();
   void setTriggerHoldTime(uint16_t value);
+  void setFfbRecoil(uint8_t mode, int16_t threshold, int16_t minPeriod);
+  uint16_t getRecoilOnTime();
+  uint16_t getRecoilOffTime();
+  void setRecoilPulse(uint16_t onTime, uint16_t offTime);
+  RecoilPattern getRecoilPattern();
+  bool setRecoilPattern(uint8_t pattern);
+  bool setRecoilStep(uint8_t pattern, uint8_t step, uint8_t duty, uint16_t time);
+  bool setRecoilShots(uint8_t pattern, uint8_t shots);
+  bool setSetting(uint8_t id, int16_t value);
+  int8_t applyBatch(const uint8_t* data, uint8_t length);
   int16_t getAmmoCount();
   void setAmmoCount(int16_t value);
   int16_t getHealth();
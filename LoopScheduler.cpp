@@ -0,0 +1,81 @@
+#include "LoopScheduler.h"
+
+LoopScheduler::LoopScheduler(LoopTask* newTasks, uint8_t newCount) {
+  tasks = newTasks;
+  count = newCount;
+  nextBackground = 0;
+  started = false;
+}
+
+bool LoopScheduler::isDue(LoopTask* task, unsigned long now) {
+  if (task->period) {
+    return (long)(now - task->due) >= 0;
+  }
+  return task->ready && task->ready();
+}
+
+void LoopScheduler::runTask(LoopTask* task, unsigned long now) {
+  if (task->period) {
+    unsigned long late = now - task->due;
+    task->maxLate = max(task->maxLate, min(late, 0xFFFF));
+    if (late >= task->period) {
+      //skip the periods that were missed instead of running them back to back
+      task->misses++;
+      task->due = now + task->period;
+    } else {
+      task->due += task->period;
+    }
+  }
+  task->run();
+  unsigned long runTime = micros() - now;
+  task->maxRun = max(task->maxRun, min(runTime, 0xFFFF));
+}
+
+void LoopScheduler::run() {
+  unsigned long now = micros();
+  if (!started) {
+    started = true;
+    for (uint8_t i = 0; i < count; i++) {
+      tasks[i].due = now;
+    }
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (isDue(&tasks[i], now)) {
+      runTask(&tasks[i], now);
+      return;
+    }
+  }
+
+  //nothing urgent, give the next background task its turn
+  for (uint8_t i = 0; i < count; i++) {
+    LoopTask* task = &tasks[nextBackground];
+    nextBackground = (nextBackground + 1) % count;
+    if (!task->period && !task->ready) {
+      runTask(task, now);
+      return;
+    }
+  }
+}
+
+uint8_t LoopScheduler::getTaskCount() {
+  return count;
+}
+
+bool LoopScheduler::getStats(uint8_t task, LoopTaskStats* stats) {
+  if (task >= count) {
+    return false;
+  }
+  stats->period = tasks[task].period;
+  stats->misses = tasks[task].misses;
+  stats->maxLate = tasks[task].maxLate;
+  stats->maxRun = tasks[task].maxRun;
+  return true;
+}
+
+void LoopScheduler::resetStats() {
+  for (uint8_t i = 0; i < count; i++) {
+    tasks[i].misses = 0;
+    tasks[i].maxLate = 0;
+    tasks[i].maxRun = 0;
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef LOOPSCHEDULER_h
+#define LOOPSCHEDULER_h
+
+#include <Arduino.h>
+
+typedef void (*TaskFunction)();
+typedef bool (*TaskReady)();
+
+//a task runs every period us, or whenever ready() says so when period is 0.
+//the table is in priority order, the first task is the most urgent
+struct LoopTask {
+  TaskFunction run;
+  uint16_t period;  //us, 0 for a task driven by ready() or a background task without it
+  TaskReady ready;
+  unsigned long due;
+  uint16_t misses;   //started a whole period or more after it was due
+  uint16_t maxLate;  //us
+  uint16_t maxRun;   //us
+};
+
+//stats of one task for the GUI report
+typedef struct {
+  uint16_t period;
+  uint16_t misses;
+  uint16_t maxLate;
+  uint16_t maxRun;
+} LoopTaskStats;
+
+//runs one task per call from loop(), the most urgent one that is due.
+//tasks are never preempted, so a task waits at most one period plus the longest maxRun of the others
+class LoopScheduler {
+public:
+  LoopScheduler(LoopTask* tasks, uint8_t count);
+  void run();
+  uint8_t getTaskCount();
+  bool getStats(uint8_t task, LoopTaskStats* stats);
+  void resetStats();
+
+private:
+  LoopTask* tasks;
+  uint8_t count;
+  uint8_t nextBackground;  //background tasks take turns
+  bool started;            //periodic tasks are first due on the first run, micros() isn't running at construction
+  bool isDue(LoopTask* task, unsigned long now);
+  void runTask(LoopTask* task, unsigned long now);
+};
+
+#endif  // LOOPSCHEDULER_h
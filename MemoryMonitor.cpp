@@ -0,0 +1,66 @@
+#include "MemoryMonitor.h"
+
+extern uint8_t _end;
+extern uint8_t __heap_start;
+extern char* __brkval;
+
+//avr-libc's free list, a block's size is followed by the pointer to the next one
+struct __freelist {
+  size_t sz;
+  struct __freelist* nx;
+};
+extern struct __freelist* __flp;
+
+MemoryMonitor memoryMonitor;
+
+//runs before .data and .bss are set up, so it has to stay a plain loop on locals
+void paintStack() __attribute__((naked, used, section(".init3")));
+void paintStack() {
+  uint8_t* p = &_end;
+  while (p <= (uint8_t*)SP) {
+    *p++ = STACK_CANARY;
+  }
+}
+
+MemoryMonitor::MemoryMonitor() {
+  watermark = (uint8_t*)RAMEND;
+  scan = NULL;
+  largestVla = 0;
+}
+
+uint8_t* MemoryMonitor::heapEnd() {
+  return __brkval ? (uint8_t*)__brkval : &__heap_start;
+}
+
+void MemoryMonitor::update() {
+  uint8_t* heap = heapEnd();
+  if (scan < heap) {
+    scan = heap;
+  }
+  //everything below scan was still painted, the stack can only have grown down to it since
+  for (uint8_t i = 0; i < STACK_SCAN_BYTES; i++) {
+    if (scan >= watermark || *scan != STACK_CANARY) {
+      watermark = scan;
+      scan = heap;
+      return;
+    }
+    scan++;
+  }
+}
+
+void MemoryMonitor::getStats(MemoryStats* stats) {
+  uint8_t* heap = heapEnd();
+  uint8_t* stack = (uint8_t*)SP;
+  uint8_t* mark = min(watermark, stack);
+
+  uint16_t heapFree = 0;
+  for (struct __freelist* block = __flp; block; block = block->nx) {
+    heapFree += block->sz + sizeof(size_t);
+  }
+
+  stats->freeStack = stack > heap ? stack - heap : 0;
+  stats->minFreeStack = mark > heap ? mark - heap : 0;
+  stats->heapUsed = heap - &__heap_start;
+  stats->heapFree = heapFree;
+  stats->largestVla = largestVla;
+}
@@ -0,0 +1,41 @@
+#ifndef MEMORYMONITOR_h
+#define MEMORYMONITOR_h
+
+#include <Arduino.h>
+
+#define STACK_CANARY 0xC5
+#define STACK_SCAN_BYTES 32  //bytes checked per update() call
+
+typedef struct {
+  uint16_t freeStack;     //between the heap and the stack pointer now
+  uint16_t minFreeStack;  //between the heap and the deepest the stack has been since boot
+  uint16_t heapUsed;      //heap break above __heap_start
+  uint16_t heapFree;      //bytes in freed heap blocks, lost to fragmentation until reused
+  uint16_t largestVla;    //largest variable length array recorded with vla()
+} MemoryStats;
+
+//free SRAM above the heap is painted with STACK_CANARY before main runs (.init3),
+//the stack overwrites the paint as it grows down, so the first byte up from the heap that lost its paint is its high water mark.
+//a frame can leave paint inside the stack, so only a scan up from the heap finds the mark
+class MemoryMonitor {
+public:
+  MemoryMonitor();
+  void update();  //from loop(), scans the next STACK_SCAN_BYTES up from the heap
+  void getStats(MemoryStats* stats);
+  void vla(uint16_t size) {
+    if (size > largestVla) {
+      largestVla = size;
+    }
+  }
+
+private:
+  uint8_t* volatile watermark;  //lowest stack byte found written so far
+  uint8_t* scan;                //next byte of the pass up from the heap to the watermark
+  volatile uint16_t largestVla;
+
+  static uint8_t* heapEnd();
+};
+
+extern MemoryMonitor memoryMonitor;
+
+#endif  // MEMORYMONITOR_h
@@ -154,6 +154,18 @@ static const uint8_t pidReportDescriptor[] PROGMEM = {
   0x95, 0x02,              //          Report Count (2)
   0x91, 0x02,              //          Output (Data,Var,Abs)
   0xC0,                    //        End Collection (Logical)
+  0x09, 0xA7,              //    Usage (Start Delay)
+  0x66, 0x03, 0x10,        //     Unit (4099)
+  0x55, 0xFD,              //     Unit Exponent (253)
+  0x15, 0x00,              //     Logical Minimum (0)
+  0x26, 0xFF, 0x7F,        //     Logical Maximum (32767)
+  0x35, 0x00,              //     Physical Minimum (0)
+  0x46, 0xFF, 0x7F,        //     Physical Maximum (32767)
+  0x75, 0x10,              //     Report Size (16)
+  0x95, 0x01,              //     Report Count (1)
+  0x91, 0x02,              //     Output (Data,Var,Abs)
+  0x55, 0x00,              //     Unit Exponent (0)
+  0x66, 0x00, 0x00,        //     Unit (0)
   0xC0,                    //End Collection Datalink (Logical) (OK)
 
   // SetEnvelopeReport
@@ -3,6 +3,10 @@
 PIDReportHandler::PIDReportHandler() {
   nextEID = 1;
   devicePaused = 0;
+  playingCount = 0;
+  effectTicks = 0;
+  customForceHead = 0;
+  downloadEffect = 0;
 }
 
 PIDReportHandler::~PIDReportHandler() {
@@ -67,14 +71,13 @@ void PIDReportHandler::UppackUsbData(uint8_t* data, uint16_t len) {
 }
 
 uint8_t PIDReportHandler::GetNextFreeEffect(void) {
-  if (nextEID == MAX_EFFECTS)
+  // nextEID is the lowest free id, past MAX_EFFECTS when all are taken
+  if (nextEID > MAX_EFFECTS)
     return 0;
 
   uint8_t id = nextEID++;
 
-  while (g_EffectStates[nextEID].state != 0) {
-    if (nextEID >= MAX_EFFECTS)
-      break;  // the last spot was taken
+  while (nextEID <= MAX_EFFECTS && g_EffectStates[nextEID].state != 0) {
     nextEID++;
   }
 
@@ -83,44 +86,190 @@ uint8_t PIDReportHandler::GetNextFreeEffect(void) {
   return id;
 }
 
+void PIDReportHandler::AddPlayingEffect(uint8_t id) {
+  for (uint8_t i = 0; i < playingCount; i++) {
+    if (playingEffects[i] == id)
+      return;
+  }
+  playingEffects[playingCount++] = id;
+}
+
+void PIDReportHandler::RemovePlayingEffect(uint8_t id) {
+  for (uint8_t i = 0; i < playingCount; i++) {
+    if (playingEffects[i] == id) {
+      // order doesn't matter, move the last entry into the hole
+      playingEffects[i] = playingEffects[--playingCount];
+      return;
+    }
+  }
+}
+
 void PIDReportHandler::StopAllEffects(void) {
-  for (uint8_t id = 0; id <= MAX_EFFECTS; id++)
-    StopEffect(id);
+  while (playingCount > 0)
+    StopEffect(playingEffects[playingCount - 1]);
 }
 
 void PIDReportHandler::StartEffect(uint8_t id) {
-  if (id > MAX_EFFECTS)
+  // a block never created or already freed has nothing to play and no memory to give back later
+  if (id == 0 || id > MAX_EFFECTS || !(g_EffectStates[id].state & MEFFECTSTATE_ALLOCATED))
     return;
-  g_EffectStates[id].state = MEFFECTSTATE_PLAYING;
-  g_EffectStates[id].elapsedTime = 0;
-  g_EffectStates[id].startTime = (uint64_t)millis();
+  volatile TEffectState* effect = &g_EffectStates[id];
+  AddPlayingEffect(id);
+  effect->state |= MEFFECTSTATE_PLAYING;
+  effect->state &= ~MEFFECTSTATE_KICKED;
+  effect->startTime = effectTicks + (uint32_t)effect->startDelay * EFFECT_TICKS_PER_MS;
+  effect->nextKick = effect->startTime;
+  effect->sampleIndex = 0;
+  SetPIDStateEffect(id, true);
+  if (effect->duration >= USB_DURATION_INFINITE || effect->loopCount == 0xFF) {
+    effect->state |= MEFFECTSTATE_INFINITE;
+  } else {
+    // at most 32767 * 255 * 5 ticks, well inside the wrap-safe range
+    effect->state &= ~MEFFECTSTATE_INFINITE;
+    effect->stopTime = effect->startTime + (uint32_t)effect->duration * effect->loopCount * EFFECT_TICKS_PER_MS;
+  }
 }
 
 void PIDReportHandler::StopEffect(uint8_t id) {
   if (id > MAX_EFFECTS)
     return;
   g_EffectStates[id].state &= ~MEFFECTSTATE_PLAYING;
-  pidBlockLoad.ramPoolAvailable += SIZE_EFFECT;
+  RemovePlayingEffect(id);
+  SetPIDStateEffect(id, false);
+}
+
+//called from the Timer3 interrupt, retires effects whose duration has run out
+//returns true when a playing effect asks for a recoil kick
+bool PIDReportHandler::EffectTick(void) {
+  uint32_t now = ++effectTicks;
+  if (devicePaused)
+    return false;
+
+  bool kick = false;
+  uint8_t i = 0;
+  while (i < playingCount) {
+    uint8_t id = playingEffects[i];
+    volatile TEffectState* effect = &g_EffectStates[id];
+    if (!(effect->state & MEFFECTSTATE_INFINITE) && (int32_t)(now - effect->stopTime) >= 0) {
+      StopEffect(id);  // moves the last entry into slot i
+    } else {
+      if (RecoilKickDue(effect, now))
+        kick = true;
+      i++;
+    }
+  }
+  return kick;
+}
+
+bool PIDReportHandler::RecoilKickDue(volatile TEffectState* effect, uint32_t now) {
+  if ((int32_t)(now - effect->nextKick) < 0 || !(pidState.status & 0x02))  // not yet, or actuators disabled
+    return false;
+
+  int16_t magnitude;
+  uint8_t type = effect->effectType;
+  if (type >= USB_EFFECT_SQUARE && type <= USB_EFFECT_SAWTOOTHUP) {
+    if (!(ffbRecoil.mode & FFB_RECOIL_PERIODIC))
+      return false;
+    magnitude = effect->magnitude;
+    // keep firing once per period for as long as the effect plays
+    uint16_t period = max(effect->period, (uint16_t)ffbRecoil.minPeriod);
+    effect->nextKick += (uint32_t)max(period, (uint16_t)1) * EFFECT_TICKS_PER_MS;
+  } else if (type == USB_EFFECT_CONSTANT || type == USB_EFFECT_RAMP) {
+    if (!(ffbRecoil.mode & (type == USB_EFFECT_CONSTANT ? FFB_RECOIL_CONSTANT : FFB_RECOIL_RAMP)) || (effect->state & MEFFECTSTATE_KICKED))
+      return false;
+    if (type == USB_EFFECT_CONSTANT) {
+      magnitude = abs(effect->magnitude);
+    } else {
+      magnitude = max(abs(effect->startMagnitude), abs(effect->endMagnitude));
+    }
+    effect->state |= MEFFECTSTATE_KICKED;
+  } else if (type == USB_EFFECT_CUSTOM) {
+    if (!(ffbRecoil.mode & FFB_RECOIL_CUSTOM) || effect->sampleCount == 0)
+      return false;
+    // step to the next sample, looping over the uploaded envelope
+    int8_t sample = customForceSamples[(uint8_t)(effect->sampleStart + effect->sampleIndex) % CUSTOM_FORCE_SAMPLES];
+    if (++effect->sampleIndex >= effect->sampleCount)
+      effect->sampleIndex = 0;
+    effect->nextKick += (uint32_t)max(effect->samplePeriod, (uint16_t)1) * EFFECT_TICKS_PER_MS;
+
+    // kick only when the envelope rises through the threshold
+    bool wasAbove = effect->state & MEFFECTSTATE_KICKED;
+    if (((int32_t)abs(sample) * 10000 / 127 * effect->gain) / 255 >= ffbRecoil.threshold) {
+      effect->state |= MEFFECTSTATE_KICKED;
+      return !wasAbove;
+    }
+    effect->state &= ~MEFFECTSTATE_KICKED;
+    return false;
+  } else {
+    return false;
+  }
+
+  return ((int32_t)magnitude * effect->gain) / 255 >= ffbRecoil.threshold;
+}
+
+void PIDReportHandler::SetPIDStateEffect(uint8_t id, bool playing) {
+  pidState.effectBlockIndex = (id << 1) | (playing ? 0x01 : 0x00);
+  pidStateChanged = true;
+}
+
+void PIDReportHandler::PauseEffects(void) {
+  if (devicePaused)
+    return;
+  devicePaused = 1;
+  pausedAt = effectTicks;
+  pidState.status |= 0x01;
+  pidStateChanged = true;
+}
+
+void PIDReportHandler::ContinueEffects(void) {
+  if (!devicePaused)
+    return;
+  // shift the playing effects so the pause doesn't count against their duration
+  uint32_t pausedFor = effectTicks - pausedAt;
+  for (uint8_t i = 0; i < playingCount; i++) {
+    volatile TEffectState* effect = &g_EffectStates[playingEffects[i]];
+    effect->startTime += pausedFor;
+    effect->stopTime += pausedFor;
+    effect->nextKick += pausedFor;
+  }
+  devicePaused = 0;
+  pidState.status &= ~(0x01);
+  pidStateChanged = true;
 }
 
 void PIDReportHandler::FreeEffect(uint8_t id) {
-  if (id > MAX_EFFECTS)
+  if (id == 0 || id > MAX_EFFECTS)
     return;
+  // only a block that was created gives its memory back, stopping an effect keeps it
+  if (g_EffectStates[id].state & MEFFECTSTATE_ALLOCATED)
+    pidBlockLoad.ramPoolAvailable += SIZE_EFFECT;
+  bool playing = g_EffectStates[id].state & MEFFECTSTATE_PLAYING;
   g_EffectStates[id].state = 0;
+  RemovePlayingEffect(id);
+  if (playing)
+    SetPIDStateEffect(id, false);
   if (id < nextEID)
     nextEID = id;
 }
 
 void PIDReportHandler::FreeAllEffects(void) {
   nextEID = 1;
+  if (playingCount > 0) {
+    // report the last effect that played as stopped, the host sees nothing is playing
+    pidState.effectBlockIndex &= ~0x01;
+    pidStateChanged = true;
+  }
+  playingCount = 0;
   memset((void*)&g_EffectStates, 0, sizeof(g_EffectStates));
   pidBlockLoad.ramPoolAvailable = MEMORY_SIZE;
 }
 
 void PIDReportHandler::EffectOperation(USB_FFBReport_EffectOperation_Output_Data_t* data) {
+  if (data->effectBlockIndex == 0 || data->effectBlockIndex > MAX_EFFECTS)
+    return;
+  g_EffectStates[data->effectBlockIndex].loopCount = data->loopCount > 0 ? data->loopCount : 1;
+
   if (data->operation == 1) {  // Start
-    if (data->loopCount > 0) g_EffectStates[data->effectBlockIndex].duration *= data->loopCount;
-    if (data->loopCount == 0xFF) g_EffectStates[data->effectBlockIndex].duration = USB_DURATION_INFINITE;
     StartEffect(data->effectBlockIndex);
   } else if (data->operation == 2) {  // StartSolo
 
@@ -150,16 +299,18 @@ void PIDReportHandler::DeviceControl(USB_FFBReport_DeviceControl_Output_Data_t*
 
   if (control == 0x01) {  // 1=Enable Actuators
     pidState.status |= 2;
+    pidStateChanged = true;
   } else if (control == 0x02) {  // 2=Disable Actuators
     pidState.status &= ~(0x02);
+    pidStateChanged = true;
   } else if (control == 0x03) {  // 3=Stop All Effects
     StopAllEffects();
   } else if (control == 0x04) {  //  4=Reset
     FreeAllEffects();
   } else if (control == 0x05) {  // 5=Pause
-    devicePaused = 1;
+    PauseEffects();
   } else if (control == 0x06) {  // 6=Continue
-    devicePaused = 0;
+    ContinueEffects();
   } else if (control & (0xFF - 0x3F)) {
   }
 }
@@ -169,18 +320,60 @@ void PIDReportHandler::DeviceGain(USB_FFBReport_DeviceGain_Output_Data_t* data)
 }
 
 void PIDReportHandler::SetCustomForce(USB_FFBReport_SetCustomForce_Output_Data_t* data) {
+  if (data->effectBlockIndex == 0 || data->effectBlockIndex > MAX_EFFECTS)
+    return;
+  volatile TEffectState* effect = &g_EffectStates[data->effectBlockIndex];
+
+  effect->samplePeriod = data->samplePeriod;
+  if (effect->sampleCount == 0) {
+    // samples will follow as download force samples, start them at the ring head
+    effect->sampleStart = customForceHead;
+  } else if (data->sampleCount > 0 && data->sampleCount < effect->sampleCount) {
+    effect->sampleCount = data->sampleCount;
+  }
+  downloadEffect = data->effectBlockIndex;
 }
 
 void PIDReportHandler::SetCustomForceData(USB_FFBReport_SetCustomForceData_Output_Data_t* data) {
+  if (data->effectBlockIndex == 0 || data->effectBlockIndex > MAX_EFFECTS || data->dataOffset >= CUSTOM_FORCE_SAMPLES)
+    return;
+  volatile TEffectState* effect = &g_EffectStates[data->effectBlockIndex];
+
+  if (data->dataOffset == 0) {
+    // a new upload claims the ring from the head on, overwriting the oldest samples
+    effect->sampleStart = customForceHead;
+    effect->sampleCount = 0;
+  }
+
+  uint8_t end = min(data->dataOffset + sizeof(data->data), CUSTOM_FORCE_SAMPLES);
+  for (uint8_t i = data->dataOffset; i < end; i++) {
+    customForceSamples[(uint8_t)(effect->sampleStart + i) % CUSTOM_FORCE_SAMPLES] = data->data[i - data->dataOffset];
+  }
+  if (end > effect->sampleCount)
+    effect->sampleCount = end;
+  customForceHead = (uint8_t)(effect->sampleStart + effect->sampleCount) % CUSTOM_FORCE_SAMPLES;
+  downloadEffect = data->effectBlockIndex;
 }
 
 void PIDReportHandler::SetDownloadForceSample(USB_FFBReport_SetDownloadForceSample_Output_Data_t* data) {
+  if (downloadEffect == 0)
+    return;
+  volatile TEffectState* effect = &g_EffectStates[downloadEffect];
+  if (effect->sampleCount >= CUSTOM_FORCE_SAMPLES)
+    return;
+
+  // the recoil output has a single axis, only x is kept
+  customForceSamples[(uint8_t)(effect->sampleStart + effect->sampleCount) % CUSTOM_FORCE_SAMPLES] = data->x;
+  effect->sampleCount++;
+  customForceHead = (uint8_t)(effect->sampleStart + effect->sampleCount) % CUSTOM_FORCE_SAMPLES;
 }
 
 void PIDReportHandler::SetEffect(USB_FFBReport_SetEffect_Output_Data_t* data) {
   volatile TEffectState* effect = &g_EffectStates[data->effectBlockIndex];
 
   effect->duration = data->duration;
+  effect->startDelay = data->startDelay;
+  effect->samplePeriod = data->samplePeriod;
   effect->directionX = data->directionX;
   effect->directionY = data->directionY;
   effect->effectType = data->effectType;
@@ -2,6 +2,7 @@
 #define _PIDREPORTHANDLER_H
 #include <Arduino.h>
 #include "PIDReportType.h"
+#include "Settings.h"
 
 class PIDReportHandler {
 public:
@@ -10,15 +11,28 @@ public:
   // Effect management
   volatile uint8_t nextEID;  // FFP effect indexes starts from 1
   volatile TEffectState g_EffectStates[MAX_EFFECTS + 1];
+  // ids of the effects currently playing, so per-tick work scales with playing effects, not MAX_EFFECTS
+  volatile uint8_t playingEffects[MAX_EFFECTS];
+  volatile uint8_t playingCount;
   volatile uint8_t devicePaused;
+  // effect clock, advanced by EffectTick() from the Timer3 interrupt
+  volatile uint32_t effectTicks;
+  volatile uint32_t pausedAt;
   //variables for storing previous values
   volatile int32_t inertiaT = 0;
   volatile int16_t oldSpeed = 0;
   volatile int16_t oldAxisPosition = 0;
   volatile USB_FFBReport_PIDStatus_Input_Data_t pidState = { 2, 30, 0 };
+  volatile bool pidStateChanged = false;  // pidState needs to go out as input report 2
   volatile USB_FFBReport_PIDBlockLoad_Feature_Data_t pidBlockLoad;
   volatile USB_FFBReport_PIDPool_Feature_Data_t pidPoolReport;
   volatile USB_FFBReport_DeviceGain_Output_Data_t deviceGain;
+  // custom force samples, each effect owns a run of sampleCount samples from sampleStart
+  int8_t customForceSamples[CUSTOM_FORCE_SAMPLES];
+  uint8_t customForceHead;
+  uint8_t downloadEffect;  // effect that SetDownloadForceSample appends to
+  // rules for turning effects into recoil kicks
+  FfbRecoilSettings ffbRecoil;
 
   //ffb state structures
   uint8_t GetNextFreeEffect(void);
@@ -27,6 +41,13 @@ public:
   void StopAllEffects(void);
   void FreeEffect(uint8_t id);
   void FreeAllEffects(void);
+  void AddPlayingEffect(uint8_t id);
+  void RemovePlayingEffect(uint8_t id);
+  bool EffectTick(void);
+  bool RecoilKickDue(volatile TEffectState* effect, uint32_t now);
+  void SetPIDStateEffect(uint8_t id, bool playing);
+  void PauseEffects(void);
+  void ContinueEffects(void);
 
   //handle output pid report
   void EffectOperation(USB_FFBReport_EffectOperation_Output_Data_t* data);
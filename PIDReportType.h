@@ -30,6 +30,7 @@
 
 #define MAX_EFFECTS 14
 #define MAX_FFB_AXIS_COUNT 0x02
+#define CUSTOM_FORCE_SAMPLES 64  // sample ring shared by all custom force effects, power of 2
 #define SIZE_EFFECT sizeof(TEffectState)
 #define MEMORY_SIZE (uint16_t)(MAX_EFFECTS * SIZE_EFFECT)
 #define TO_LT_END_16(x) ((x << 8) & 0xFF00) | ((x >> 8) & 0x00FF)
@@ -44,7 +45,7 @@ typedef struct  //PID state
 {
   uint8_t reportId;          //2
   uint8_t status;            // Bits: 0=Device Paused,1=Actuators Enabled,2=Safety Switch,3=Actuator Override Switch,4=Actuator Power
-  uint8_t effectBlockIndex;  // Bit7=Effect Playing, Bit0..7=EffectId (1..40)
+  uint8_t effectBlockIndex;  // Bit0=Effect Playing, Bit1..7=EffectId (1..40), packed in descriptor order
 } USB_FFBReport_PIDStatus_Input_Data_t;
 
 ///Host-->Device
@@ -62,7 +63,8 @@ typedef struct  //FFB: Set Effect Output Report
   uint8_t enableAxis;              // bits: 0=X, 1=Y, 2=DirectionEnable
   uint8_t directionX;              // angle (0=0 .. 255=360deg)
   uint8_t directionY;              // angle (0=0 .. 255=360deg)
-                                   //	uint16_t	startDelay;	// 0..32767 ms
+  uint16_t typeSpecificBlockOffset[2];
+  uint16_t startDelay;             // 0..32767 ms
 } USB_FFBReport_SetEffect_Output_Data_t;
 
 typedef struct  //FFB: Set Envelope Output Report
@@ -210,7 +212,7 @@ typedef struct
 typedef struct {
   uint8_t command;
   int16_t arg;
-  uint8_t data[29];  //this total needs to match size given in PidDesciptor.h line 631, and size of Settings struct in Settings.h
+  uint8_t data[29];  //this total needs to match size given in PidDesciptor.h line 631, and the GUI part of the Settings struct in Settings.h
 } GUI_Report;
 
 ///effect
@@ -232,6 +234,11 @@ typedef struct {
 #define MEFFECTSTATE_FREE 0x00
 #define MEFFECTSTATE_ALLOCATED 0x01
 #define MEFFECTSTATE_PLAYING 0x02
+#define MEFFECTSTATE_INFINITE 0x04
+#define MEFFECTSTATE_KICKED 0x08  // single recoil kick already fired, or custom force above threshold
+
+// effects are timed in Timer3 ticks (5 kHz)
+#define EFFECT_TICKS_PER_MS 5
 
 #define X_AXIS_ENABLE 0x01
 #define Y_AXIS_ENABLE 0x02
@@ -263,8 +270,14 @@ typedef struct {
   uint16_t phase;  // 0..255 (=0..359, exp-2)
   int16_t startMagnitude;
   int16_t endMagnitude;
-  uint16_t period;  // 0..32767 ms
-  uint16_t duration, elapsedTime;
-  uint64_t startTime;
+  uint16_t period;      // 0..32767 ms
+  uint16_t duration;    // 0..32767 ms
+  uint16_t startDelay;  // 0..32767 ms
+  uint8_t loopCount;
+  uint32_t startTime, stopTime;  // effect ticks
+  uint32_t nextKick;             // effect tick of the next recoil kick or custom force sample
+  //custom force, samples live in the shared ring
+  uint8_t sampleStart, sampleCount, sampleIndex;
+  uint16_t samplePeriod;  // 0..32767 ms
 } TEffectState;
 #endif
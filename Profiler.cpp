@@ -0,0 +1,59 @@
+#include "Profiler.h"
+
+#ifdef PROFILER_ENABLED
+Profiler profiler;
+
+Profiler::Profiler() {
+  ticks = 0;
+  reset();
+}
+
+void Profiler::tick() {
+  ticks++;
+}
+
+uint32_t Profiler::clock() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t count = TCNT3;
+  uint32_t value = ticks;
+  //matched but the interrupt has not run yet
+  if ((TIFR3 & (1 << OCF3A)) && count < PROFILER_TIMER_TOP / 2) {
+    value++;
+  }
+  SREG = oldSREG;
+  return value * (PROFILER_TIMER_TOP + 1) + count;
+}
+
+void Profiler::record(uint8_t stage, uint32_t duration) {
+  ProfileHistogram* histogram = &histograms[stage];
+  uint8_t bucket = 0;
+  for (uint32_t d = duration; d > 1 && bucket < PROFILE_BUCKETS - 1; d >>= 1) {
+    bucket++;
+  }
+  if (histogram->buckets[bucket] < 0xFFFF) {
+    histogram->buckets[bucket]++;
+  }
+  if (duration > histogram->maximum) {
+    histogram->maximum = duration > 0xFFFF ? 0xFFFF : duration;
+  }
+}
+
+bool Profiler::getHistogram(uint8_t stage, ProfileHistogram* histogram) {
+  if (stage >= PROFILE_STAGES) {
+    return false;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  *histogram = histograms[stage];
+  SREG = oldSREG;
+  return true;
+}
+
+void Profiler::reset() {
+  uint8_t oldSREG = SREG;
+  cli();
+  memset(histograms, 0, sizeof(histograms));
+  SREG = oldSREG;
+}
+#endif
@@ -0,0 +1,53 @@
+#ifndef PROFILER_h
+#define PROFILER_h
+
+#include <Arduino.h>
+
+//#define PROFILER_ENABLED  //uncomment to time the loop stages and the Timer3 interrupt
+
+//stages with a histogram each
+#define PROFILE_TIMERS 0       //deferred timer wheel callbacks
+#define PROFILE_SERIAL 1       //processSerial
+#define PROFILE_BUTTONS 2      //InputDebounce process calls
+#define PROFILE_ADC 3          //axis reads
+#define PROFILE_SEND_STATE 4   //joystick report
+#define PROFILE_ISR 5          //Timer3 interrupt
+#define PROFILE_ISR_LATENCY 6  //compare match to Timer3 interrupt entry, the jitter of everything it runs
+#define PROFILE_USB_OUT 7      //UppackUsbData, FFB and GUI reports from the host
+#define PROFILE_STAGES 8
+
+//bucket n counts durations of 2^n to 2^(n+1)-1 clock ticks of 0.5us, the last one everything longer
+#define PROFILE_BUCKETS 12
+#define PROFILER_TIMER_TOP 399  //OCR3A
+
+typedef struct {
+  uint16_t buckets[PROFILE_BUCKETS];
+  uint16_t maximum;  //clock ticks, saturates
+} ProfileHistogram;
+
+#ifdef PROFILER_ENABLED
+//Timer3 runs at 0.5us a tick in CTC mode, extended by the number of compare matches to a free running clock
+class Profiler {
+public:
+  Profiler();
+  void tick();  //first thing in the Timer3 interrupt
+  uint32_t clock();
+  void record(uint8_t stage, uint32_t duration);
+  bool getHistogram(uint8_t stage, ProfileHistogram* histogram);
+  void reset();
+
+private:
+  volatile uint32_t ticks;
+  ProfileHistogram histograms[PROFILE_STAGES];
+};
+
+extern Profiler profiler;
+
+#define PROFILE_START(name) uint32_t name = profiler.clock()
+#define PROFILE_END(name, stage) profiler.record(stage, profiler.clock() - name)
+#else
+#define PROFILE_START(name)
+#define PROFILE_END(name, stage)
+#endif
+
+#endif  // PROFILER_h
@@ -1,6 +1,11 @@
 #include "Joystick.h"
+#include "SerialParser.h"
+#include "RecoilSequencer.h"
+#include "TimerWheel.h"
+#include "LoopScheduler.h"
+#include "Profiler.h"
+#include "MemoryMonitor.h"
 #include "InputDebounce.h"
-#include <arduino-timer.h>
 #include "avdweb_AnalogReadFast.h"
 #include <digitalWriteFast.h>
 
@@ -18,7 +23,8 @@ Joystick_ controller(JOYSTICK_DEFAULT_REPORT_ID, JOYSTICK_TYPE_GAMEPAD, buttonCo
                      false, false, false,
                      false, false);
 
-auto timer = timer_create_default();  // create a timer with default settings
+TimerWheel timerWheel;
+SerialParser serialParser;
 
 static InputDebounce btnTrigger;
 static InputDebounce btnLeft;
@@ -34,23 +40,54 @@ const int buttonPins[buttonCount] = {
   BTN_COIN
 };
 
-bool isFiring = false;
-bool sendUpdate = false;
+//recoil shot phases, each output level ends on a Timer1 compare match
+#define RECOIL_IDLE 0
+#define RECOIL_ON 1       //pattern running
+#define RECOIL_LOCKOUT 2  //solenoid released, next shot held off
+volatile uint8_t recoilPhase = RECOIL_IDLE;
+bool recoilDrive = false;  //the pattern drives the solenoid, not just the button and light
+bool recoilOutputOn = false;  //the solenoid is driven in the current level
+RecoilSequencer recoilSequencer;
+volatile bool sendUpdate = false;
+#define INPUT_PERIOD_US 500  //buttons and axes are read at 2 kHz
 //boolean screenReady = false;
+uint16_t reportFrame = 0xFFFF;
 int lastXAxisValue = -1;
 int lastYAxisValue = -1;
 unsigned long lastTriggerRepeat = 0;
+//host to device clock offset in us, the smallest offset seen is the one with the least transport delay
+#define TIME_SYNC_WINDOW 16
+int32_t timeSyncOffset = 0;
+int32_t timeSyncWindowMin = 0;
+uint8_t timeSyncSamples = 0;
+bool timeSyncValid = false;
+//recoil shots scheduled for a device time, fired from the Timer3 interrupt
+#define SCHEDULED_RECOIL_COUNT 4
+WheelTimer scheduledRecoil[SCHEDULED_RECOIL_COUNT];
+//WheelTimer displayTimer;
 int16_t lastAmmoCount = -1;
 int16_t lastHealth = 0;
 int8_t lastHealthPct = 0;
 
+//priority order, the effect tick, PID reports and GUI commands already run in the Timer3 interrupt
+LoopTask tasks[] = {
+  { readInputs, INPUT_PERIOD_US },
+  { sendReport, 0, reportReady },
+  { runDeferredTimers },
+  { processSerial },
+  { checkStack }
+};
+LoopScheduler scheduler(tasks, sizeof(tasks) / sizeof(tasks[0]));
+
 void setup() {
+#if defined(CDC_ENABLED)
   Serial.begin(SERIAL_BAUDRATE);
-  Serial.setTimeout(20);
+#endif
 
   controller.begin(false);
 
-  controller.loadSettings();
+  controller.loadProfiles();
+  controller.setLoopScheduler(&scheduler);
 
   btnTrigger.registerCallbacks(pressedCallback, releasedCallback, pressedDurationCallback, releasedDurationCallback);
   btnTrigger.setup(BTN_TRIGGER, BUTTON_DEBOUNCE_DELAY, InputDebounce::PIM_INT_PULL_UP_RES);
@@ -73,6 +110,11 @@ void setup() {
   pinMode(LIGHT_RELAY_PIN, OUTPUT);
   digitalWriteFast(LIGHT_RELAY_PIN, LOW);
 
+#ifdef LATENCY_TEST
+  pinMode(LATENCY_TEST_PIN, OUTPUT);
+  digitalWriteFast(LATENCY_TEST_PIN, LOW);
+#endif
+
   cli();
   TCCR3A = 0;  //set TCCR1A 0
   TCCR3B = 0;  //set TCCR1B 0
@@ -81,6 +123,11 @@ void setup() {
   TCCR3B |= (1 << WGM32);  //open CTC mode
   TCCR3B |= (1 << CS31);   //set CS11 1(8-fold Prescaler)
   TIMSK3 |= (1 << OCIE3A);
+
+  //Timer1 times the recoil pulse in CTC mode, its clock only runs while a shot is in progress
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TIMSK1 = (1 << OCIE1A);
   sei();
 
   /*
@@ -88,13 +135,60 @@ void setup() {
   do {
     display.drawXBMP(34, 18, logo_width, logo_height, logo);
   } while (display.nextPage());
-  timer.in(2000, clearDisplay);
+  timerWheel.in(&displayTimer, 2000 * WHEEL_TICKS_PER_MS, clearDisplay);
 
   display.setFont(u8g_font_helvB24n);*/
 }
 
 ISR(TIMER3_COMPA_vect) {
+#ifdef PROFILER_ENABLED
+  profiler.tick();
+  profiler.record(PROFILE_ISR_LATENCY, TCNT3);
+#endif
+  PROFILE_START(isrStart);
   controller.getUSBPID();
+  controller.recoilThermal.cool();
+  timerWheel.tick();
+  PROFILE_END(isrStart, PROFILE_ISR);
+}
+
+bool fireScheduledRecoil(void *) {
+  pressFire(true, false);
+  return false;
+}
+
+//a time sync frame was read at deviceTime, keep the offset with the least delay in each window
+//so the estimate follows crystal drift between host and device
+void timeSync(uint32_t hostTime, uint32_t deviceTime) {
+  int32_t offset = deviceTime - hostTime;
+  if (timeSyncSamples == 0 || offset < timeSyncWindowMin) {
+    timeSyncWindowMin = offset;
+  }
+  if (!timeSyncValid || offset < timeSyncOffset) {
+    timeSyncOffset = offset;
+    timeSyncValid = true;
+  }
+  if (++timeSyncSamples >= TIME_SYNC_WINDOW) {
+    timeSyncOffset = timeSyncWindowMin;
+    timeSyncSamples = 0;
+  }
+}
+
+//fire at a host time, the timer wheel fires it within 200us of the matching device time
+uint8_t scheduleRecoil(uint32_t hostTime) {
+  if (!timeSyncValid) {
+    return FIRE_AT_NO_SYNC;
+  }
+  //32 bit on any core, both clocks wrap
+  int32_t delay = hostTime + timeSyncOffset - (uint32_t)micros();
+  uint16_t ticks = constrain((delay + WHEEL_TICK_US - 1) / WHEEL_TICK_US, 0, 0xFFFF);
+  for (uint8_t i = 0; i < SCHEDULED_RECOIL_COUNT; i++) {
+    if (!timerWheel.active(&scheduledRecoil[i])) {
+      timerWheel.in(&scheduledRecoil[i], ticks, fireScheduledRecoil, NULL, WHEEL_TIMER_IN_ISR);
+      return FIRE_AT_SCHEDULED;
+    }
+  }
+  return FIRE_AT_FULL;
 }
 
 int getButtonNumFromPin(int pin) {
@@ -106,39 +200,86 @@ int getButtonNumFromPin(int pin) {
   return 0;
 }
 
-bool setRecoilReleased(void *) {
-  isFiring = false;
-  return false;
+//set the recoil output for the next pattern level, or end the shot and time the lockout.
+//the Timer3 interrupt can hold this one off past the compare. the level that ended then ran on for the
+//ticks the counter has counted since, the next one is cut short to keep the pattern's timing and skipped
+//when it is over already, or the counter would miss its compare and run on to 0xFFFF, 262 ms stuck.
+//the thermal model gets the time the solenoid was actually driven
+void nextRecoilStep() {
+  uint16_t late = TCNT1;
+  if (recoilOutputOn) {
+    controller.recoilThermal.heat(late);
+  }
+  uint16_t end = 0;  //ticks past the compare the next level ends at
+  for (;;) {
+    bool on;
+    uint16_t ticks = recoilSequencer.next(on);
+    if (ticks == 0) {
+      break;
+    }
+    end = min((uint32_t)end + ticks, 0xFFFF);
+    uint16_t now = TCNT1;
+    if (end > now + 1) {
+      recoilOutputOn = on && recoilDrive;
+      if (recoilOutputOn) {
+        controller.recoilThermal.heat(end - now);
+        digitalWriteFast(RECOIL_RELAY_PIN, HIGH);
+      } else {
+        digitalWriteFast(RECOIL_RELAY_PIN, LOW);
+      }
+      //in CTC mode the counter has already restarted, only the length of this level changes
+      OCR1A = end - 1;
+      return;
+    }
+  }
+  recoilOutputOn = false;
+  digitalWriteFast(RECOIL_RELAY_PIN, LOW);
+  controller.setButton(getButtonNumFromPin(BTN_TRIGGER), LOW);
+  digitalWriteFast(LIGHT_RELAY_PIN, LOW);
+  sendUpdate = true;
+  recoilPhase = RECOIL_LOCKOUT;
+  //the lockout runs from the release
+  TCNT1 = 0;
+  OCR1A = max(controller.getRecoilOffTime() / RECOIL_TIMER_US, RECOIL_MIN_TICKS) - 1;
 }
 
-bool releaseFire(void *) {
-  if (isFiring) {
-    digitalWriteFast(RECOIL_RELAY_PIN, LOW);
-    controller.setButton(getButtonNumFromPin(BTN_TRIGGER), LOW);
-    digitalWriteFast(LIGHT_RELAY_PIN, LOW);
-    sendUpdate = true;
-    timer.in(RECOIL_MS, setRecoilReleased);
+ISR(TIMER1_COMPA_vect) {
+  if (recoilPhase == RECOIL_ON) {
+    nextRecoilStep();
+  } else {
+    TCCR1B = 0;
+    recoilPhase = RECOIL_IDLE;
   }
-  return false;
 }
 
 void pressFire(bool doRecoil, bool setButton) {
-  if (!isFiring) {
-    isFiring = true;
-    if (doRecoil && controller.hasAmmo()) {
-      digitalWriteFast(RECOIL_RELAY_PIN, HIGH);
-    }
+  //called from loop() and from the Timer3 interrupt
+  uint8_t oldSREG = SREG;
+  cli();
+  if (recoilPhase == RECOIL_IDLE) {
+    recoilPhase = RECOIL_ON;
+    recoilDrive = doRecoil && controller.hasAmmo();
     if (setButton) {
       controller.setButton(getButtonNumFromPin(BTN_TRIGGER), HIGH);
       digitalWriteFast(LIGHT_RELAY_PIN, HIGH);
     }
     sendUpdate = true;
-    timer.in(RECOIL_RELEASE_MS, releaseFire);
+    //run Timer1 from zero through the active pattern
+    TCCR1B = 0;
+    TCNT1 = 0;
+    recoilSequencer.start(controller.getRecoilPattern(), recoilDrive ? controller.recoilThermal.scale() : RECOIL_SCALE_FULL);
+    nextRecoilStep();
+    TIFR1 = (1 << OCF1A);
+    TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10);
     //controller.setAmmoCount(controller.getAmmoCount() - 1);
   }
+  SREG = oldSREG;
 }
 
 void pressedCallback(uint8_t pinIn) {
+#ifdef LATENCY_TEST
+  controller.inputCaptured();
+#endif
   controller.setButton(getButtonNumFromPin(pinIn), HIGH);
   sendUpdate = true;
 
@@ -148,6 +289,9 @@ void pressedCallback(uint8_t pinIn) {
 }
 
 void releasedCallback(uint8_t pinIn) {
+#ifdef LATENCY_TEST
+  controller.inputCaptured();
+#endif
   controller.setButton(getButtonNumFromPin(pinIn), LOW);
   sendUpdate = true;
   lastTriggerRepeat = 0;
@@ -169,7 +313,7 @@ void releasedDurationCallback(uint8_t pinIn, unsigned long duration) {
 /*
 bool clearDisplay(void *) {
   screenReady = true;
-  return true;
+  return false;
 }
 
 void updateDisplayStats() {
@@ -207,22 +351,24 @@ void updateDisplayStats() {
   }
 }*/
 
-void loop() {
-  sendUpdate = false;
-  timer.tick();
-
-  processSerial();
-
+//buttons and axes
+void readInputs() {
+  PROFILE_START(buttonsStart);
   unsigned long now = millis();
   btnTrigger.process(now);
   btnLeft.process(now);
   btnBottom.process(now);
   btnStart.process(now);
   btnCoin.process(now);
+  PROFILE_END(buttonsStart, PROFILE_BUTTONS);
 
+  PROFILE_START(adcStart);
   const int currentXAxisValue = 1024 - analogReadFast(AXIS_X_PIN);
   if (abs(currentXAxisValue - lastXAxisValue) > 4) {
     lastXAxisValue = currentXAxisValue;
+#ifdef LATENCY_TEST
+    controller.inputCaptured();
+#endif
     controller.setXAxis(currentXAxisValue);
     sendUpdate = true;
   }
@@ -230,60 +376,206 @@ void loop() {
   const int currentYAxisValue = 1024 - analogReadFast(AXIS_Y_PIN);
   if (abs(currentYAxisValue - lastYAxisValue) > 4) {
     lastYAxisValue = currentYAxisValue;
+#ifdef LATENCY_TEST
+    controller.inputCaptured();
+#endif
     controller.setYAxis(currentYAxisValue);
     sendUpdate = true;
   }
+  PROFILE_END(adcStart, PROFILE_ADC);
+}
+
+//the host polls once per frame, so one report per frame carries every change
+bool reportReady() {
+  return sendUpdate && DynamicHID().frameNumber() != reportFrame;
+}
+
+void sendReport() {
+  reportFrame = DynamicHID().frameNumber();
+  sendUpdate = false;
+  PROFILE_START(sendStart);
+  controller.sendState();
+  PROFILE_END(sendStart, PROFILE_SEND_STATE);
+}
+
+void checkStack() {
+  memoryMonitor.update();
+}
 
+void runDeferredTimers() {
+  PROFILE_START(timersStart);
+  timerWheel.runDeferred();
+  PROFILE_END(timersStart, PROFILE_TIMERS);
   //updateDisplayStats();
+}
 
-  if (sendUpdate) {
-    sendUpdate = false;
-    controller.sendState();
-  }
+void loop() {
+  scheduler.run();
 }
 
 //Serial port - commands and output.
+//every game state command is also a GUI command, so the sketch builds with -DCDC_DISABLED for HID only cabinets
+#if defined(CDC_ENABLED)
 void processSerial() {
+  PROFILE_START(serialStart);
+  //only take what has already arrived, a partial line is finished on a later pass
+  int count = Serial.available();
+  while (count-- > 0) {
+    uint8_t parsed = serialParser.feed(Serial.read());
+    if (parsed == SERIAL_PARSED_COMMAND) {
+      runSerialCommand(serialParser.command(), serialParser.commandHash(), serialParser.arg[0], serialParser.arg[1], serialParser.arg[2]);
+    } else if (parsed == SERIAL_PARSED_FRAME) {
+      runSerialFrame(serialParser.frame(), serialParser.frameLength(), serialParser.frameTime());
+    }
+  }
+  PROFILE_END(serialStart, PROFILE_SERIAL);
+}
+
+int16_t frameInt16(const uint8_t *data) {
+  return (int16_t)(data[0] | (data[1] << 8));
+}
 
-  if (Serial.available()) {
-    char cmd[32];
-    int16_t arg1 = -32768, arg2 = -32768, arg3 = -32768;
-    String line = Serial.readStringUntil('!');
-    Serial.readBytes(&cmd[0], 1);  //read the ! or it will loop again
-    line.toLowerCase();
-    sscanf(line.c_str(), "%s %d %d %d", cmd, &arg1, &arg2, &arg3);
+unsigned long frameUInt32(const uint8_t *data) {
+  return data[0] | ((unsigned long)data[1] << 8) | ((unsigned long)data[2] << 16) | ((unsigned long)data[3] << 24);
+}
 
-    if (strcmp_P(cmd, PSTR("recoil")) == 0) {
+uint8_t frameArgLength(uint8_t op) {
+  switch (op) {
+    case SERIAL_OP_RECOIL:
+    case SERIAL_OP_USE_AMMO:
+      return 1;
+    case SERIAL_OP_SETTING:
+      return 3;
+    case SERIAL_OP_TIME_SYNC:
+    case SERIAL_OP_FIRE_AT:
+      return 4;
+    default:
+      return 2;
+  }
+}
+
+//binary frame, several opcodes can share one frame, see SerialParser.h
+void runSerialFrame(const uint8_t *data, uint8_t length, unsigned long receivedAt) {
+  uint8_t i = 0;
+  while (i < length) {
+    uint8_t op = data[i++];
+    uint8_t argLength = frameArgLength(op);
+    if (i + argLength > length) {
+      return;
+    }
+    const uint8_t *args = &data[i];
+    i += argLength;
+    switch (op) {
+      case SERIAL_OP_RECOIL:
+        if (args[0]) {
+          pressFire(true, false);
+        }
+        break;
+      case SERIAL_OP_AMMO:
+        controller.setAmmoCount(frameInt16(args));
+        break;
+      case SERIAL_OP_HEALTH:
+        controller.setHealth(frameInt16(args));
+        break;
+      case SERIAL_OP_MAX_HEALTH:
+        controller.setMaxHealth(frameInt16(args));
+        sendUpdate = true;
+        break;
+      case SERIAL_OP_USE_AMMO:
+        controller.setUseAmmoCount(args[0] > 0);
+        break;
+      case SERIAL_OP_SETTING:
+        controller.setSetting(args[0], frameInt16(&args[1]));
+        sendUpdate = true;
+        break;
+      case SERIAL_OP_TIME_SYNC:
+        {
+          timeSync(frameUInt32(args), receivedAt);
+          //echo host time and device time so the host can work out the round trip
+          uint8_t reply[9];
+          reply[0] = SERIAL_OP_TIME_SYNC;
+          memcpy(&reply[1], args, 4);
+          for (uint8_t b = 0; b < 4; b++) {
+            reply[5 + b] = receivedAt >> (8 * b);
+          }
+          SerialParser::writeFrame(Serial, reply, sizeof(reply));
+        }
+        break;
+      case SERIAL_OP_FIRE_AT:
+        {
+          //the host has to know a shot it timed did not make it
+          uint8_t reply[6];
+          reply[0] = SERIAL_OP_FIRE_AT;
+          reply[1] = scheduleRecoil(frameUInt32(args));
+          memcpy(&reply[2], args, 4);
+          SerialParser::writeFrame(Serial, reply, sizeof(reply));
+        }
+        break;
+      default:
+        //unknown opcode, the length of its args is unknown too
+        return;
+    }
+  }
+}
+
+//one jump on the name hash instead of a strcmp_P chain, see SerialParser.h
+void runSerialCommand(const char *cmd, uint8_t hash, int16_t arg1, int16_t arg2, int16_t arg3) {
+  switch (hash) {
+    SERIAL_COMMAND("recoil")
       if (arg1 == 1) {
         pressFire(true, false);
       }
-    } else if (strcmp_P(cmd, PSTR("setammocount")) == 0 || strcmp_P(cmd, PSTR("setammo")) == 0) {
+      break;
+    SERIAL_COMMAND("setammocount")
+      controller.setAmmoCount(arg1);
+      break;
+    SERIAL_COMMAND("setammo")
       controller.setAmmoCount(arg1);
       //sendUpdate = true;
-    } else if (strcmp_P(cmd, PSTR("useammocount")) == 0) {
+      break;
+    SERIAL_COMMAND("useammocount")
       controller.setUseAmmoCount(arg1 > 0);
       //sendUpdate = true;
-    } else if (strcmp_P(cmd, PSTR("sethealth")) == 0) {
+      break;
+    SERIAL_COMMAND("sethealth")
       controller.setHealth(arg1);
       //sendUpdate = true;
-    } else if (strcmp_P(cmd, PSTR("setmaxhealth")) == 0) {
+      break;
+    SERIAL_COMMAND("setmaxhealth")
       controller.setMaxHealth(arg1);
       sendUpdate = true;
-    } else if (strcmp_P(cmd, PSTR("settriggerrepeatrate")) == 0) {
+      break;
+    SERIAL_COMMAND("settriggerrepeatrate")
       controller.setTriggerRepeatRate(arg1);
       sendUpdate = true;
-    } else if (strcmp_P(cmd, PSTR("settriggerholdtime")) == 0) {
+      break;
+    SERIAL_COMMAND("settriggerholdtime")
       controller.setTriggerHoldTime(arg1);
       sendUpdate = true;
-    } else if (strcmp_P(cmd, PSTR("setautorecoil")) == 0) {
+      break;
+    SERIAL_COMMAND("setautorecoil")
       controller.setAutoRecoil(arg1 > 0);
       sendUpdate = true;
-    } else if (strcmp_P(cmd, PSTR("setuniqueid")) == 0) {
+      break;
+    SERIAL_COMMAND("setffbrecoil")
+      controller.setFfbRecoil(arg1, arg2, arg3);
+      break;
+    SERIAL_COMMAND("setprofile")
+      //switch settings profile, read from the EEPROM journal
+      controller.setProfile(arg1);
+      sendUpdate = true;
+      break;
+    SERIAL_COMMAND("setuniqueid")
       //this help match the hid device to com port from host
       controller.setUniqueId(arg1);
-    } else if (strcmp_P(cmd, PSTR("getuniqueid")) == 0) {
+      break;
+    SERIAL_COMMAND("getuniqueid")
       //this help match the hid device to com port from host
       Serial.println(controller.getUniqueId());
-    }
+      break;
   }
 }
+#else
+void processSerial() {
+}
+#endif
@@ -0,0 +1,73 @@
+#include "RecoilSequencer.h"
+
+RecoilSequencer::RecoilSequencer() {
+  shotsLeft = 0;
+  stepTicks = 0;
+  lowTicks = 0;
+}
+
+void RecoilSequencer::start(const RecoilPattern& newPattern, uint16_t scale) {
+  pattern = newPattern;
+  if (scale < RECOIL_SCALE_FULL) {
+    for (uint8_t i = 0; i < RECOIL_PATTERN_STEPS && pattern.steps[i].time; i++) {
+      uint8_t duty = pattern.steps[i].duty;
+      uint16_t stepScale = duty == RECOIL_DUTY_FULL ? RECOIL_SCALE_FULL / 2 + scale / 2 : scale;
+      if (duty) {
+        //a step cut to nothing is skipped, time 0 would end the pattern
+        pattern.steps[i].time = max(((uint32_t)pattern.steps[i].time * stepScale) >> 8, 1);
+      }
+    }
+  }
+  shotsLeft = max(pattern.shots, 1);
+  stepIndex = 0;
+  stepTicks = pattern.steps[0].time / RECOIL_TIMER_US;
+  lowTicks = 0;
+}
+
+uint16_t RecoilSequencer::next(bool& on) {
+  if (lowTicks) {
+    uint16_t ticks = lowTicks;
+    lowTicks = 0;
+    stepTicks -= ticks;
+    on = false;
+    return ticks;
+  }
+
+  while (stepTicks < RECOIL_MIN_TICKS) {
+    //a step shorter than the minimum is skipped, time 0 also ends the shot
+    if (++stepIndex >= RECOIL_PATTERN_STEPS || pattern.steps[stepIndex].time == 0) {
+      if (shotsLeft <= 1) {
+        shotsLeft = 0;
+        return 0;
+      }
+      shotsLeft--;
+      stepIndex = 0;
+    }
+    stepTicks = pattern.steps[stepIndex].time / RECOIL_TIMER_US;
+  }
+
+  uint8_t duty = pattern.steps[stepIndex].duty;
+  if (duty == 0 || duty == RECOIL_DUTY_FULL) {
+    uint16_t ticks = stepTicks;
+    stepTicks = 0;
+    on = duty != 0;
+    return ticks;
+  }
+
+  uint8_t period = min(stepTicks, RECOIL_PWM_TICKS);
+  uint8_t high = ((uint16_t)period * duty + 127) / RECOIL_DUTY_FULL;
+  if (high < RECOIL_MIN_TICKS) {
+    high = 0;
+  } else if (period - high < RECOIL_MIN_TICKS) {
+    high = period;
+  }
+  if (high == 0) {
+    stepTicks -= period;
+    on = false;
+    return period;
+  }
+  lowTicks = period - high;
+  stepTicks -= high;
+  on = true;
+  return high;
+}
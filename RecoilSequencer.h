@@ -0,0 +1,29 @@
+#ifndef RECOILSEQUENCER_h
+#define RECOILSEQUENCER_h
+
+#include <Arduino.h>
+#include "Settings.h"
+
+#define RECOIL_TIMER_US 4     //Timer1 tick with the 64-fold prescaler
+#define RECOIL_PWM_TICKS 50   //200us, 5 kHz hold PWM
+#define RECOIL_MIN_TICKS 4    //shortest output level, leaves the compare interrupt time to reload OCR1A
+#define RECOIL_SCALE_FULL 256
+
+//steps through a RecoilPattern as a list of output levels and their lengths in Timer1 ticks.
+//full and zero duty steps are a single level, the others are chopped into RECOIL_PWM_TICKS periods.
+//a hot solenoid gets a scale below RECOIL_SCALE_FULL, hold steps shrink with it and kicks down to half, gaps stay as they are
+class RecoilSequencer {
+public:
+  RecoilSequencer();
+  void start(const RecoilPattern& pattern, uint16_t scale);  //RECOIL_SCALE_FULL runs the pattern as stored
+  uint16_t next(bool& on);  //ticks to hold the output at on, 0 once the last shot is over
+
+private:
+  RecoilPattern pattern;
+  uint8_t stepIndex;
+  uint8_t shotsLeft;
+  uint16_t stepTicks;  //ticks left in the current step
+  uint8_t lowTicks;    //off part of the current PWM period
+};
+
+#endif  // RECOILSEQUENCER_h
@@ -0,0 +1,57 @@
+#include "RecoilThermal.h"
+
+RecoilThermal::RecoilThermal() {
+  settings.heatLimit = 0;
+  settings.coolingTime = 0;
+  heatTicks = 0;
+  coolCount = 0;
+}
+
+uint32_t RecoilThermal::limitTicks() {
+  return settings.heatLimit * (1000UL / RECOIL_TIMER_US);
+}
+
+void RecoilThermal::heat(uint16_t ticks) {
+  heatTicks += ticks;
+}
+
+void RecoilThermal::cool() {
+  if (++coolCount < RECOIL_THERMAL_COOL_TICKS) {
+    return;
+  }
+  coolCount = 0;
+  if (settings.coolingTime == 0) {
+    heatTicks = 0;
+    return;
+  }
+  //heat -= heat * dt / tau
+  heatTicks -= heatTicks / (settings.coolingTime * (1000UL / RECOIL_THERMAL_COOL_MS));
+}
+
+uint16_t RecoilThermal::scale() {
+  if (settings.heatLimit == 0) {
+    return RECOIL_SCALE_FULL;
+  }
+  uint32_t limit = limitTicks();
+  uint32_t knee = limit / 4 * RECOIL_THERMAL_KNEE;
+  if (heatTicks <= knee) {
+    return RECOIL_SCALE_FULL;
+  }
+  if (heatTicks >= limit) {
+    return 0;
+  }
+  return RECOIL_SCALE_FULL - (heatTicks - knee) * RECOIL_SCALE_FULL / (limit - knee);
+}
+
+uint32_t RecoilThermal::getHeat() {
+  return heatTicks;
+}
+
+uint8_t RecoilThermal::getLoad() {
+  if (settings.heatLimit == 0) {
+    return 0;
+  }
+  //divide the limit rather than multiply the heat, which is past 2^32 / 100 with a long heat limit
+  uint32_t load = heatTicks / (limitTicks() / 100);
+  return min(load, 255);
+}
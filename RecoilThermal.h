@@ -0,0 +1,32 @@
+#ifndef RECOILTHERMAL_h
+#define RECOILTHERMAL_h
+
+#include <Arduino.h>
+#include "Settings.h"
+#include "RecoilSequencer.h"
+
+#define RECOIL_THERMAL_COOL_TICKS 50  //Timer3 ticks between cooling steps, 10 ms
+#define RECOIL_THERMAL_COOL_MS 10
+#define RECOIL_THERMAL_KNEE 3         //throttling starts at 3/4 of the heat limit
+
+//first order model of the solenoid coil temperature.
+//heat is the driven time in Timer1 ticks and decays with the cooling time constant,
+//so a duty cycle d settles at d * coolingTime and may run forever when that stays below heatLimit
+class RecoilThermal {
+public:
+  RecoilThermalSettings settings;
+
+  RecoilThermal();
+  void heat(uint16_t ticks);  //the solenoid was driven for ticks
+  void cool();                //from the 5 kHz Timer3 interrupt
+  uint16_t scale();           //RECOIL_SCALE_FULL below the knee, down to 0 at the heat limit
+  uint32_t getHeat();
+  uint8_t getLoad();  //heat in % of the limit
+
+private:
+  uint32_t heatTicks;
+  uint8_t coolCount;
+  uint32_t limitTicks();
+};
+
+#endif  // RECOILTHERMAL_h
@@ -0,0 +1,165 @@
+#include "SerialParser.h"
+#include <util/crc16.h>
+
+#define SERIAL_COMMAND_END '!'
+
+SerialParser::SerialParser() {
+  reset();
+}
+
+void SerialParser::reset() {
+  state = PARSE_START;
+  complete = false;
+  nameLength = 0;
+  hash = 0;
+  name[0] = '\0';
+  argCount = 0;
+  for (uint8_t i = 0; i < SERIAL_ARG_COUNT; i++) {
+    arg[i] = SERIAL_ARG_NONE;
+  }
+}
+
+const char* SerialParser::command() {
+  return name;
+}
+
+uint8_t SerialParser::commandHash() {
+  return hash;
+}
+
+const uint8_t* SerialParser::frame() {
+  return frameData;
+}
+
+uint8_t SerialParser::frameLength() {
+  return frameSize;
+}
+
+unsigned long SerialParser::frameTime() {
+  return frameStart;
+}
+
+void SerialParser::writeFrame(Stream& out, const uint8_t* data, uint8_t length) {
+  uint8_t crc = _crc8_ccitt_update(0, length);
+  for (uint8_t i = 0; i < length; i++) {
+    crc = _crc8_ccitt_update(crc, data[i]);
+  }
+  out.write(SERIAL_FRAME_SYNC);
+  out.write(length);
+  out.write(data, length);
+  out.write(crc);
+}
+
+void SerialParser::storeArg() {
+  if (hasDigits) {
+    int32_t v = negative ? -value : value;
+    arg[argCount++] = constrain(v, -32768, 32767);
+  }
+}
+
+uint8_t SerialParser::feedFrame(uint8_t c) {
+  switch (state) {
+    case PARSE_FRAME_LENGTH:
+      if (c == 0 || c > SERIAL_FRAME_MAX_LENGTH) {
+        reset();
+        break;
+      }
+      frameSize = c;
+      frameIndex = 0;
+      crc = _crc8_ccitt_update(0, c);
+      state = PARSE_FRAME_DATA;
+      break;
+    case PARSE_FRAME_DATA:
+      frameData[frameIndex++] = c;
+      crc = _crc8_ccitt_update(crc, c);
+      if (frameIndex == frameSize) {
+        state = PARSE_FRAME_CRC;
+      }
+      break;
+    default:
+      if (c == crc) {
+        complete = true;
+        return SERIAL_PARSED_FRAME;
+      }
+      //corrupt frame, drop it and look for the next sync or text command
+      reset();
+      break;
+  }
+  return SERIAL_PARSED_NONE;
+}
+
+uint8_t SerialParser::feed(uint8_t c) {
+  if (complete) {
+    //the caller is done with the last command, start a fresh line
+    reset();
+  }
+
+  if (state >= PARSE_FRAME_LENGTH) {
+    return feedFrame(c);
+  }
+  if (state == PARSE_START && c == SERIAL_FRAME_SYNC) {
+    frameStart = micros();
+    state = PARSE_FRAME_LENGTH;
+    return SERIAL_PARSED_NONE;
+  }
+
+  if (c == SERIAL_COMMAND_END) {
+    if (state == PARSE_NUMBER) {
+      storeArg();
+    }
+    if (nameLength == 0) {
+      reset();
+      return SERIAL_PARSED_NONE;
+    }
+    name[nameLength] = '\0';
+    complete = true;
+    return SERIAL_PARSED_COMMAND;
+  }
+
+  bool space = isspace(c);
+  switch (state) {
+    case PARSE_START:
+      if (space) {
+        break;
+      }
+      state = PARSE_NAME;
+      //fall through
+    case PARSE_NAME:
+      if (space) {
+        state = PARSE_SPACE;
+      } else if (nameLength < SERIAL_COMMAND_MAX_LENGTH) {
+        c = tolower(c);
+        name[nameLength++] = c;
+        hash = hash * SERIAL_HASH_MULTIPLIER + c;
+      }
+      break;
+    case PARSE_SPACE:
+      if (space) {
+        break;
+      }
+      negative = false;
+      hasDigits = false;
+      value = 0;
+      state = PARSE_NUMBER;
+      if (c == '-' || c == '+') {
+        negative = c == '-';
+        break;
+      }
+      //fall through
+    case PARSE_NUMBER:
+      if (c >= '0' && c <= '9') {
+        hasDigits = true;
+        if (value < 100000) {
+          value = value * 10 + (c - '0');
+        }
+      } else {
+        //like sscanf, a non digit ends the arg and any text after it is ignored
+        storeArg();
+        state = (space && hasDigits && argCount < SERIAL_ARG_COUNT) ? PARSE_SPACE : PARSE_SKIP;
+      }
+      break;
+    default:
+      break;
+  }
+  return SERIAL_PARSED_NONE;
+}
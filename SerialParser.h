@@ -0,0 +1,87 @@
+#ifndef SERIALPARSER_h
+#define SERIALPARSER_h
+
+#include <Arduino.h>
+
+#define SERIAL_COMMAND_MAX_LENGTH 24
+#define SERIAL_ARG_COUNT 3
+#define SERIAL_ARG_NONE -32768  //value of args missing from the line, same as the old sscanf defaults
+
+//binary frames share the port with the text commands: SYNC, LEN, LEN payload bytes, CRC8 over LEN and payload.
+//the payload is a run of opcodes, each followed by its little endian args
+#define SERIAL_FRAME_SYNC 0xA5  //never part of a text command
+#define SERIAL_FRAME_MAX_LENGTH 32
+#define SERIAL_OP_RECOIL 0x01      //uint8 fire
+#define SERIAL_OP_AMMO 0x02        //int16 ammo count
+#define SERIAL_OP_HEALTH 0x03      //int16 health
+#define SERIAL_OP_MAX_HEALTH 0x04  //int16 max health
+#define SERIAL_OP_USE_AMMO 0x05    //uint8 use ammo count
+#define SERIAL_OP_SETTING 0x06     //uint8 SETTING_* id, int16 value
+#define SERIAL_OP_TIME_SYNC 0x07   //uint32 host time in us, answered with the same opcode, host time and device time
+#define SERIAL_OP_FIRE_AT 0x08     //uint32 host time in us to fire the recoil at, answered with the same opcode, uint8 status and the host time
+#define FIRE_AT_SCHEDULED 0  //status of a FIRE_AT answer
+#define FIRE_AT_NO_SYNC 1    //no TIME_SYNC read yet, the shot was dropped
+#define FIRE_AT_FULL 2       //every scheduled shot is taken, the shot was dropped
+
+//what feed() found
+#define SERIAL_PARSED_NONE 0
+#define SERIAL_PARSED_COMMAND 1  //text command in command() and arg[]
+#define SERIAL_PARSED_FRAME 2    //binary frame in frame() and frameLength()
+
+//command names are hashed as they are read, h = h * 33 + c over 8 bits.
+//the dispatch switch uses the hash as case label, so two names that collide fail to compile,
+//and each case confirms the name with one strcmp_P against its PROGMEM string
+#define SERIAL_HASH_MULTIPLIER 33
+constexpr uint8_t serialCommandHash(const char* name, uint8_t hash = 0) {
+  return *name ? serialCommandHash(name + 1, (uint8_t)(hash * SERIAL_HASH_MULTIPLIER + *name)) : hash;
+}
+
+#define SERIAL_COMMAND(name) \
+  case serialCommandHash(name): \
+    if (strcmp_P(cmd, PSTR(name)) != 0) break;
+
+//incremental parser for the "command arg1 arg2 arg3!" text protocol and the binary frames
+//bytes are fed one at a time as they arrive, so a partial line never blocks the loop
+class SerialParser {
+public:
+  SerialParser();
+  uint8_t feed(uint8_t c);  //returns SERIAL_PARSED_* once a full command or frame has been parsed
+  const char* command();
+  uint8_t commandHash();
+  const uint8_t* frame();
+  uint8_t frameLength();
+  unsigned long frameTime();  //micros() when the frame's sync byte was read
+  static void writeFrame(Stream& out, const uint8_t* data, uint8_t length);
+  int16_t arg[SERIAL_ARG_COUNT];
+
+private:
+  enum : uint8_t {
+    PARSE_START,   //skipping whitespace before the command
+    PARSE_NAME,    //reading the command name
+    PARSE_SPACE,   //skipping whitespace before an arg
+    PARSE_NUMBER,  //reading an arg
+    PARSE_SKIP,    //ignoring the rest of the line
+    PARSE_FRAME_LENGTH,
+    PARSE_FRAME_DATA,
+    PARSE_FRAME_CRC
+  } state;
+  bool complete;
+  char name[SERIAL_COMMAND_MAX_LENGTH + 1];
+  uint8_t nameLength;
+  uint8_t hash;
+  uint8_t argCount;
+  bool negative;
+  bool hasDigits;
+  int32_t value;
+  uint8_t frameData[SERIAL_FRAME_MAX_LENGTH];
+  uint8_t frameSize;
+  uint8_t frameIndex;
+  uint8_t crc;
+  unsigned long frameStart;
+
+  void reset();
+  void storeArg();
+  uint8_t feedFrame(uint8_t c);
+};
+
+#endif  // SERIALPARSER_h
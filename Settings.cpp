@@ -1,43 +1,248 @@
 #include "Settings.h"
-#include <EEPROM.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "EEPROMWriter.h"
 
-uint8_t SettingsEEPROM::calcChecksum() {
-  uint8_t i, checksum;
+#define SETTINGS_MAX_LENGTH (SETTINGS_SLOT_SIZE - sizeof(SettingsRecordHeader) - sizeof(uint16_t))
 
-  checksum = ~((uint8_t*)this)[0];
-  for (i = 1; i < sizeof(SettingsEEPROM) - 1; i++)
-    checksum = checksum ^ ~((uint8_t*)this)[i];
-  return checksum;
+SettingsEEPROM::SettingsEEPROM() {
+  header.profile = 0xFF;
+  headSlot = -1;
+  legacy = false;
+  for (uint8_t i = 0; i < SETTINGS_PROFILES; i++) {
+    profileSlot[i] = -1;
+  }
+}
+
+uint16_t SettingsEEPROM::slotAddress(uint8_t slot) {
+  return slot * SETTINGS_SLOT_SIZE;
+}
+
+uint16_t SettingsEEPROM::calcCrc() {
+  uint16_t value = 0xFFFF;
+  for (uint8_t i = 0; i < sizeof(SettingsRecordHeader) + sizeof(Settings); i++) {
+    value = _crc16_update(value, ((uint8_t*)&header)[i]);
+  }
+  return value;
+}
+
+//the header of a slot, false when it can't be the start of a record
+bool SettingsEEPROM::readHeader(uint8_t slot, SettingsRecordHeader* recordHeader) {
+  EEPROMWriter::read(slotAddress(slot), recordHeader, sizeof(SettingsRecordHeader));
+  if (recordHeader->length == 0 || recordHeader->length > SETTINGS_MAX_LENGTH || recordHeader->profile >= SETTINGS_PROFILES) {
+    return false;
+  }
+  //an older version is a prefix of Settings and loads with defaults after it, a newer firmware's layout can't be read.
+  //version 0 only ever held the GUI part of the old block
+  if (recordHeader->version > SETTINGS_VERSION) {
+    return false;
+  }
+  return recordHeader->version > 0 || recordHeader->length <= LEGACY_SETTINGS_SIZE;
+}
+
+//true when the record is whole, a save cut short by power loss fails the crc
+bool SettingsEEPROM::recordWhole(uint8_t slot, const SettingsRecordHeader* recordHeader) {
+  uint16_t address = slotAddress(slot);
+  uint16_t value = 0xFFFF;
+  uint8_t length = sizeof(SettingsRecordHeader) + recordHeader->length;
+  for (uint8_t i = 0; i < length; i++) {
+    value = _crc16_update(value, EEPROMWriter::read(address + i));
+  }
+  uint16_t recordCrc;
+  EEPROMWriter::read(address + length, &recordCrc, sizeof(recordCrc));
+  return value == recordCrc;
+}
+
+bool SettingsEEPROM::readRecord(uint8_t slot, SettingsRecordHeader* recordHeader) {
+  return readHeader(slot, recordHeader) && recordWhole(slot, recordHeader);
+}
+
+//a slot can be written over unless it holds the newest record of a profile
+bool SettingsEEPROM::slotFree(uint8_t slot) {
+  if (legacy && slot == 0) {
+    return false;
+  }
+  for (uint8_t i = 0; i < SETTINGS_PROFILES; i++) {
+    if (profileSlot[i] == slot) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//a save skips the slots holding other profiles' newest records, so the sequence does not rise with the slot
+//and there is no order to search in. the headers of all slots are read, and only the newest record of each
+//profile is checked against its crc, an older one only when the newer one was cut short
+void SettingsEEPROM::begin() {
+  SettingsRecordHeader headers[SETTINGS_SLOTS];
+  uint16_t unchecked = 0;  //bit per slot
+  for (uint8_t slot = 0; slot < SETTINGS_SLOTS; slot++) {
+    if (readHeader(slot, &headers[slot])) {
+      unchecked |= 1 << slot;
+    }
+  }
+  for (uint8_t profile = 0; profile < SETTINGS_PROFILES; profile++) {
+    for (;;) {
+      int8_t newest = -1;
+      for (uint8_t slot = 0; slot < SETTINGS_SLOTS; slot++) {
+        if ((unchecked & (1 << slot)) && headers[slot].profile == profile && (newest < 0 || headers[slot].sequence > headers[newest].sequence)) {
+          newest = slot;
+        }
+      }
+      if (newest < 0) {
+        break;
+      }
+      unchecked &= ~(1 << newest);
+      if (recordWhole(newest, &headers[newest])) {
+        profileSlot[profile] = newest;
+        if (headSlot < 0 || headers[newest].sequence > header.sequence) {
+          headSlot = newest;
+          header.sequence = headers[newest].sequence;
+        }
+        break;
+      }
+    }
+  }
+  //the first save of profile 0 moves the old block into the ring, until then its slot is kept
+  Settings settings;
+  legacy = profileSlot[0] < 0 && loadLegacy(&settings);
+}
+
+//the GUI part of Settings with an XOR checksum, as saved before the journal, becomes profile 0
+bool SettingsEEPROM::loadLegacy(Settings* settings) {
+  uint8_t block[LEGACY_SETTINGS_SIZE + 1];
+  EEPROMWriter::read(0, block, sizeof(block));
+  uint8_t checksum = ~block[0];
+  for (uint8_t i = 1; i < LEGACY_SETTINGS_SIZE; i++) {
+    checksum = checksum ^ ~block[i];
+  }
+  //the old saves always started with the firmware type, the XOR alone passes for some half written records
+  if (checksum != block[LEGACY_SETTINGS_SIZE] || strncmp_P((const char*)block, PSTR(FIRMWARE_TYPE), sizeof(FIRMWARE_TYPE)) != 0) {
+    return false;
+  }
+  memcpy(settings, block, LEGACY_SETTINGS_SIZE);
+  return true;
 }
 
+//kick and hold, a three round burst and a heavy kick and hold
+const RecoilPattern defaultPatterns[RECOIL_PATTERN_COUNT] PROGMEM = {
+  { { { RECOIL_DUTY_FULL, 10000 }, { 96, 30000 } }, 1 },
+  { { { RECOIL_DUTY_FULL, 8000 }, { 96, 12000 }, { 0, 40000 } }, 3 },
+  { { { RECOIL_DUTY_FULL, 20000 }, { 128, 40000 } }, 1 }
+};
+
 Settings SettingsEEPROM::getDefaults() {
-  SettingsEEPROM settingsE;
-  settingsE.data.xAxisMinimum = JOYSTICK_DEFAULT_AXIS_MINIMUM;
-  settingsE.data.xAxisMaximum = JOYSTICK_DEFAULT_AXIS_MAXIMUM;
-  settingsE.data.yAxisMinimum = JOYSTICK_DEFAULT_AXIS_MINIMUM;
-  settingsE.data.yAxisMaximum = JOYSTICK_DEFAULT_AXIS_MAXIMUM;
-  settingsE.data.autoRecoil = true;
-  settingsE.data.triggerRepeatRate = 100;
-  settingsE.data.triggerHoldTime = 1000;
-  return settingsE.data;
-}
-
-Settings SettingsEEPROM::load(bool defaults) {
-  SettingsEEPROM settingsE;
-  uint8_t checksum;
-  EEPROM.get(0, settingsE);
-  checksum = settingsE.calcChecksum();
-
-  //Loading defaults
-  if (defaults || (settingsE.checksum != checksum)) {
-    return getDefaults();
-  }
-  return settingsE.data;
-}
-
-void SettingsEEPROM::save(Settings settings) {
-  SettingsEEPROM settingsE;
-  settingsE.data = settings;
-  settingsE.checksum = settingsE.calcChecksum();
-  EEPROM.put(0, settingsE);
+  Settings settings;
+  memset(&settings, 0, sizeof(settings));
+  settings.xAxisMinimum = JOYSTICK_DEFAULT_AXIS_MINIMUM;
+  settings.xAxisMaximum = JOYSTICK_DEFAULT_AXIS_MAXIMUM;
+  settings.yAxisMinimum = JOYSTICK_DEFAULT_AXIS_MINIMUM;
+  settings.yAxisMaximum = JOYSTICK_DEFAULT_AXIS_MAXIMUM;
+  settings.autoRecoil = true;
+  settings.triggerRepeatRate = 100;
+  settings.triggerHoldTime = 1000;
+  settings.ffbRecoil.mode = FFB_RECOIL_PERIODIC | FFB_RECOIL_CONSTANT | FFB_RECOIL_RAMP | FFB_RECOIL_CUSTOM;
+  settings.ffbRecoil.threshold = 2000;
+  settings.ffbRecoil.minPeriod = RECOIL_RELEASE_MS + RECOIL_MS;
+  settings.recoilPulse.onTime = RECOIL_RELEASE_MS * 1000U;
+  settings.recoilPulse.offTime = RECOIL_MS * 1000U;
+  settings.recoilPattern = RECOIL_PATTERN_PULSE;
+  memcpy_P(settings.recoilPatterns, defaultPatterns, sizeof(defaultPatterns));
+  settings.recoilThermal.heatLimit = 10000;  //a third of the time on sustained
+  settings.recoilThermal.coolingTime = 30;
+  return settings;
+}
+
+Settings SettingsEEPROM::load(uint8_t profile) {
+  if (saving() && header.profile == profile) {
+    //the EEPROM is half written, the record being saved is the newest one
+    return data;
+  }
+  Settings settings = getDefaults();
+  int8_t slot = profile < SETTINGS_PROFILES ? profileSlot[profile] : -1;
+  SettingsRecordHeader recordHeader;
+  if (slot >= 0 && readRecord(slot, &recordHeader)) {
+    //fields an older record lacks keep their defaults
+    EEPROMWriter::read(slotAddress(slot) + sizeof(SettingsRecordHeader), &settings, min(recordHeader.length, sizeof(Settings)));
+  } else if (profile == 0 && legacy) {
+    loadLegacy(&settings);
+  }
+  return settings;
+}
+
+bool SettingsEEPROM::save(uint8_t profile, Settings settings) {
+  if (profile >= SETTINGS_PROFILES) {
+    return false;
+  }
+  if (saving()) {
+    //a save during a save of the same profile rewrites the same slot
+    if (header.profile != profile) {
+      return false;
+    }
+  } else {
+    if (eepromWriter.busy()) {
+      return false;
+    }
+    //the buffer still holds the last record written, skip the save when it is this profile's and unchanged
+    if (header.profile == profile && profileSlot[profile] == headSlot && memcmp(&data, &settings, sizeof(Settings)) == 0) {
+      return true;
+    }
+    uint8_t slot = headSlot < 0 ? 0 : (headSlot + 1) % SETTINGS_SLOTS;
+    while (!slotFree(slot)) {
+      //at most one slot per profile is kept, so there is always a free one
+      slot = (slot + 1) % SETTINGS_SLOTS;
+    }
+    header.sequence = headSlot >= 0 ? header.sequence + 1 : 0;
+    headSlot = slot;
+    //the record it replaces stays in EEPROM until this one is whole, so power loss falls back to it
+    profileSlot[profile] = slot;
+    if (profile == 0) {
+      legacy = false;
+    }
+  }
+  header.profile = profile;
+  header.version = SETTINGS_VERSION;
+  header.length = sizeof(Settings);
+  data = settings;
+  crc = calcCrc();
+  //the crc goes last, a save cut short leaves the previous record as the newest one
+  eepromWriter.write(slotAddress(headSlot), &header, sizeof(SettingsRecordHeader) + sizeof(Settings) + sizeof(crc));
+  return true;
+}
+
+bool SettingsEEPROM::saving() {
+  return eepromWriter.busy(&header);
+}
+
+static uint8_t deviceCrc(const DeviceSettings* device) {
+  uint8_t value = 0;
+  for (uint8_t i = 0; i < sizeof(DeviceSettings) - sizeof(device->crc); i++) {
+    value = _crc8_ccitt_update(value, ((const uint8_t*)device)[i]);
+  }
+  return value;
+}
+
+uint16_t DeviceEEPROM::loadUniqueId() {
+  DeviceSettings device;
+  //the first copy is written first, it is the newer one when both are whole
+  for (uint8_t copy = 0; copy < DEVICE_SETTINGS_COPIES; copy++) {
+    EEPROMWriter::read(DEVICE_EEPROM_ADDRESS + copy * sizeof(device), &device, sizeof(device));
+    //a blank EEPROM reads 0xFF, which fails the crc
+    if (device.crc == deviceCrc(&device)) {
+      return device.uniqueId;
+    }
+  }
+  return 0;
+}
+
+bool DeviceEEPROM::saveUniqueId(uint16_t uniqueId) {
+  if (eepromWriter.busy() && !eepromWriter.busy(data)) {
+    return false;
+  }
+  for (uint8_t copy = 0; copy < DEVICE_SETTINGS_COPIES; copy++) {
+    data[copy].uniqueId = uniqueId;
+    data[copy].crc = deviceCrc(&data[copy]);
+  }
+  eepromWriter.write(DEVICE_EEPROM_ADDRESS, data, sizeof(data));
+  return true;
 }
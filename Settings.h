@@ -15,10 +15,68 @@
 #define LIGHT_RELAY_PIN 10
 #define AXIS_X_PIN A0
 #define AXIS_Y_PIN A1
+#define LATENCY_TEST_PIN 14  //high from a captured input until the report carrying it is sent
+//#define LATENCY_TEST  //uncomment to add the latency fields to the joystick report and drive LATENCY_TEST_PIN
 #define BUTTON_DEBOUNCE_DELAY 50  //[ms]
 #define SERIAL_BAUDRATE 115200
-#define RECOIL_MS 40
-#define RECOIL_RELEASE_MS 40
+#define RECOIL_MS 40          //default lockout after a shot
+#define RECOIL_RELEASE_MS 40  //default solenoid on time
+
+//which FFB effects are translated into recoil kicks
+#define FFB_RECOIL_PERIODIC 0x01  //fire at the effect period while it plays
+#define FFB_RECOIL_CONSTANT 0x02  //one kick per constant force effect
+#define FFB_RECOIL_RAMP 0x04      //one kick per ramp force effect
+#define FFB_RECOIL_CUSTOM 0x08    //one kick each time the custom force samples cross the threshold
+
+//ids for setting a single value over the binary serial protocol
+#define SETTING_X_AXIS_MINIMUM 1
+#define SETTING_X_AXIS_MAXIMUM 2
+#define SETTING_Y_AXIS_MINIMUM 3
+#define SETTING_Y_AXIS_MAXIMUM 4
+#define SETTING_AUTO_RECOIL 5
+#define SETTING_TRIGGER_REPEAT_RATE 6
+#define SETTING_TRIGGER_HOLD_TIME 7
+#define SETTING_FFB_RECOIL_MODE 8
+#define SETTING_FFB_RECOIL_THRESHOLD 9
+#define SETTING_FFB_RECOIL_MIN_PERIOD 10
+#define SETTING_RECOIL_ON_TIME 11
+#define SETTING_RECOIL_OFF_TIME 12
+#define SETTING_RECOIL_PATTERN 13
+#define SETTING_RECOIL_HEAT_LIMIT 14
+#define SETTING_RECOIL_COOLING_TIME 15
+#define SETTING_PROFILE 16
+
+//recoil waveforms, a shot runs the steps of the active pattern once per burst shot
+#define RECOIL_PATTERN_PULSE 0  //plain pulse of recoilPulse.onTime, patterns 1..RECOIL_PATTERN_COUNT are tables
+#define RECOIL_PATTERN_COUNT 3
+#define RECOIL_PATTERN_STEPS 4
+#define RECOIL_DUTY_FULL 255
+
+typedef struct {
+  uint8_t mode;       //FFB_RECOIL_* bits
+  int16_t threshold;  //minimum magnitude (0..10000) after effect gain that counts as a shot
+  int16_t minPeriod;  //ms, caps the autofire rate of periodic effects
+} FfbRecoilSettings;
+
+typedef struct {
+  uint16_t onTime;   //us the solenoid is driven for each shot
+  uint16_t offTime;  //us after a shot before the next one can start
+} RecoilPulseSettings;
+
+typedef struct {
+  uint8_t duty;   //0..255 of the solenoid drive, PWM below RECOIL_DUTY_FULL
+  uint16_t time;  //us, 0 ends the pattern
+} RecoilStep;
+
+typedef struct {
+  RecoilStep steps[RECOIL_PATTERN_STEPS];
+  uint8_t shots;  //steps are repeated this many times, end on a duty 0 step to leave a gap between shots
+} RecoilPattern;
+
+typedef struct {
+  uint16_t heatLimit;    //ms of solenoid on time the coil can absorb, 0 turns the thermal model off
+  uint16_t coolingTime;  //s, time constant of the coil cooling down
+} RecoilThermalSettings;
 
 typedef struct {
   char id[10];
@@ -30,18 +88,74 @@ typedef struct {
   bool autoRecoil;
   int16_t triggerRepeatRate;
   int16_t triggerHoldTime;
-} Settings;  //this total needs to match size given in PidDesciptor.h line 631, and size of Settings struct in Settings.h
+  //fields above make up the GUI settings report, they need to fit the size given in PidDesciptor.h line 631
+  FfbRecoilSettings ffbRecoil;
+  RecoilPulseSettings recoilPulse;
+  uint8_t recoilPattern;  //active pattern, RECOIL_PATTERN_PULSE or 1..RECOIL_PATTERN_COUNT
+  RecoilPattern recoilPatterns[RECOIL_PATTERN_COUNT];
+  RecoilThermalSettings recoilThermal;
+} Settings;
+
+//every profile is journaled in one ring of slots, each save goes to the next slot that holds no profile's newest record.
+//a profile that is never saved again keeps its slot, so with all profiles saved the active one still turns over 5 of the 8 slots
+#define SETTINGS_PROFILES 4
+#define SETTINGS_SLOT_SIZE 120
+#define SETTINGS_SLOTS (DEVICE_EEPROM_ADDRESS / SETTINGS_SLOT_SIZE)  //at most 16, begin() keeps a bit per slot
+//values of the device itself go after the ring, they stay the same whichever profile is active
+#define DEVICE_EEPROM_SIZE 64
+#define DEVICE_EEPROM_ADDRESS (E2END + 1 - DEVICE_EEPROM_SIZE)
+#define SETTINGS_VERSION 1  //fields are only ever appended, older records are a prefix of Settings
+#define LEGACY_SETTINGS_SIZE 29  //the block with an XOR checksum at address 0 from before the journal
+
+typedef struct {
+  uint32_t sequence;  //counts up by one per save over all profiles, never wraps in the life of the EEPROM
+  uint8_t profile;
+  uint8_t version;
+  uint8_t length;  //bytes of Settings in the record, the crc follows them
+} SettingsRecordHeader;
 
-//all settings
+//the settings journal, only the active profile is kept in RAM and others are read when switched to
 class SettingsEEPROM {
 public:
+  //the record as it goes to EEPROM, it has to stay untouched while saving()
+  SettingsRecordHeader header;
   Settings data;
-  uint8_t checksum;
+  uint16_t crc;
+
+  SettingsEEPROM();
+  void begin();  //finds the newest record of each profile, once at startup
+  Settings load(uint8_t profile);  //defaults for the fields its record lacks
+  static Settings getDefaults();
+  bool save(uint8_t profile, Settings settings);  //returns at once, the EE_READY interrupt writes the changed bytes. false while another profile is written
+  bool saving();
+
+private:
+  int8_t profileSlot[SETTINGS_PROFILES];  //slot of each profile's newest record, -1 when there is none
+  int8_t headSlot;  //slot of the newest record
+  bool legacy;      //slot 0 still holds the old settings block of profile 0
+  uint16_t slotAddress(uint8_t slot);
+  uint16_t calcCrc();
+  bool readHeader(uint8_t slot, SettingsRecordHeader* recordHeader);
+  bool recordWhole(uint8_t slot, const SettingsRecordHeader* recordHeader);
+  bool readRecord(uint8_t slot, SettingsRecordHeader* recordHeader);
+  bool slotFree(uint8_t slot);
+  bool loadLegacy(Settings* settings);
+};
+
+typedef struct {
+  uint16_t uniqueId;
+  uint8_t crc;
+} DeviceSettings;
+
+//the record is kept twice and written in order, a save cut short leaves one copy whole
+#define DEVICE_SETTINGS_COPIES 2
+
+class DeviceEEPROM {
+public:
+  DeviceSettings data[DEVICE_SETTINGS_COPIES];
 
-  Settings load(bool defaults);
-  Settings getDefaults();
-  void save(Settings settings);
-  uint8_t calcChecksum();
+  static uint16_t loadUniqueId();  //0 when none was saved, safe before setup() for the USB serial number
+  bool saveUniqueId(uint16_t uniqueId);  //returns at once, false while a profile is written
 };
 
 /*
@@ -0,0 +1,118 @@
+#include "TimerWheel.h"
+
+static void initList(WheelList* list) {
+  list->head = NULL;
+  list->tail = &list->head;
+}
+
+TimerWheel::TimerWheel() {
+  ticks = 0;
+  for (uint8_t i = 0; i < WHEEL_SLOTS; i++) {
+    initList(&slots[i]);
+  }
+  initList(&fired);
+  initList(&deferred);
+}
+
+//list operations need interrupts off outside the Timer3 interrupt
+void TimerWheel::add(WheelList* list, WheelTimer* timer) {
+  timer->next = NULL;
+  timer->prev = list->tail;
+  *list->tail = timer;
+  list->tail = &timer->next;
+  timer->list = list;
+}
+
+void TimerWheel::remove(WheelTimer* timer) {
+  *timer->prev = timer->next;
+  if (timer->next) {
+    timer->next->prev = timer->prev;
+  } else {
+    timer->list->tail = timer->prev;
+  }
+  timer->list = NULL;
+}
+
+void TimerWheel::schedule(WheelTimer* timer, uint16_t delay) {
+  timer->expires = ticks + max(delay, 1);
+  add(&slots[timer->expires & (WHEEL_SLOTS - 1)], timer);
+}
+
+void TimerWheel::in(WheelTimer* timer, uint16_t delay, WheelCallback callback, void* arg, uint8_t flags) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (timer->list) {
+    remove(timer);
+  }
+  timer->interval = delay;
+  timer->callback = callback;
+  timer->arg = arg;
+  timer->flags = flags;
+  schedule(timer, delay);
+  SREG = oldSREG;
+}
+
+void TimerWheel::cancel(WheelTimer* timer) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (timer->list) {
+    remove(timer);
+  }
+  SREG = oldSREG;
+}
+
+bool TimerWheel::active(WheelTimer* timer) {
+  return timer->list != NULL;
+}
+
+uint32_t TimerWheel::now() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint32_t value = ticks;
+  SREG = oldSREG;
+  return value;
+}
+
+void TimerWheel::tick() {
+  ticks++;
+  //only timers due on this turn leave the slot, callbacks run once the slot is walked
+  //so they can add or cancel any timer
+  WheelTimer* timer = slots[ticks & (WHEEL_SLOTS - 1)].head;
+  while (timer) {
+    WheelTimer* next = timer->next;
+    if (timer->expires == ticks) {
+      remove(timer);
+      add((timer->flags & WHEEL_TIMER_IN_ISR) ? &fired : &deferred, timer);
+    }
+    timer = next;
+  }
+
+  while (fired.head) {
+    timer = fired.head;
+    remove(timer);
+    if (timer->callback(timer->arg) && !timer->list) {
+      schedule(timer, timer->interval);
+    }
+  }
+}
+
+void TimerWheel::runDeferred() {
+  while (true) {
+    cli();
+    WheelTimer* timer = deferred.head;
+    if (timer) {
+      remove(timer);
+    }
+    sei();
+    if (!timer) {
+      return;
+    }
+    if (timer->callback(timer->arg)) {
+      cli();
+      if (!timer->list) {
+        schedule(timer, timer->interval);
+      }
+      sei();
+    }
+  }
+}
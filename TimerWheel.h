@@ -0,0 +1,53 @@
+#ifndef TIMERWHEEL_h
+#define TIMERWHEEL_h
+
+#include <Arduino.h>
+
+#define WHEEL_TICK_US 200  //advanced by the 5 kHz Timer3 interrupt
+#define WHEEL_TICKS_PER_MS 5
+#define WHEEL_SLOTS 16     //power of 2, timers further out wait in their slot for later turns
+#define WHEEL_TIMER_IN_ISR 0x01  //run the callback in the interrupt instead of deferring it to loop()
+
+struct WheelTimer;
+struct WheelList {
+  WheelTimer* head;
+  WheelTimer** tail;
+};
+
+//return true to run again after the same interval, like arduino-timer
+typedef bool (*WheelCallback)(void* arg);
+
+//owned by the caller, usually static, so the wheel never allocates
+struct WheelTimer {
+  WheelTimer* next;
+  WheelTimer** prev;  //the next field pointing at this timer, unlinks in O(1) from any list
+  WheelList* list;    //NULL when idle
+  uint32_t expires;
+  uint16_t interval;
+  uint8_t flags;
+  WheelCallback callback;
+  void* arg;
+};
+
+class TimerWheel {
+public:
+  TimerWheel();
+  void in(WheelTimer* timer, uint16_t ticks, WheelCallback callback, void* arg = NULL, uint8_t flags = 0);
+  void cancel(WheelTimer* timer);
+  bool active(WheelTimer* timer);
+  uint32_t now();
+  void tick();         //from the Timer3 interrupt
+  void runDeferred();  //from loop(), runs the expired timers without WHEEL_TIMER_IN_ISR
+
+private:
+  volatile uint32_t ticks;
+  WheelList slots[WHEEL_SLOTS];
+  WheelList fired;
+  WheelList deferred;
+
+  void add(WheelList* list, WheelTimer* timer);
+  void remove(WheelTimer* timer);
+  void schedule(WheelTimer* timer, uint16_t ticks);
+};
+
+#endif  // TIMERWHEEL_h
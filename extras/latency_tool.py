@@ -0,0 +1,285 @@
+#!/usr/bin/env python3
+"""Input to USB latency statistics for firmware built with LATENCY_TEST.
+
+With LATENCY_TEST the joystick report carries seven vendor bytes:
+  sequence id    counts reports that carry a captured input
+  latency        us from the capture (button edge or axis step) to the report going to the USB endpoint
+  sent at        micros() on the device when the report went to the endpoint
+LATENCY_TEST_PIN is high over the same span as latency, so a scope on that pin
+and the USB lines can check the device side.
+
+    latency_tool.py /dev/hidraw3              read reports until Ctrl+C
+    latency_tool.py /dev/hidraw3 -n 1000 --log reports.csv
+    latency_tool.py --simulate -n 5000        no hardware, a simulated gun on a pipe
+
+Stages, each as a distribution:
+  capture->queue   from the report itself
+  queue->host      host read time against the device send time
+  capture->host    the two together
+The device and host clocks are lined up on the fastest reports of each window,
+with a straight line through those minima to follow crystal drift. queue->host
+is therefore counted from the fastest transfer seen, not from zero; the fixed
+part of the USB delay needs the scope.
+"""
+
+import argparse
+import os
+import random
+import struct
+import sys
+import threading
+import time
+
+REPORT_ID = 1
+REPORT_SIZE = 16     # id, buttons, X, Y, latency fields, ammo count, use ammo count
+LATENCY_OFFSET = 6   # sequence id, little endian us latency and little endian micros() at send
+LATENCY_FORMAT = "<BHI"
+
+INPUT_PERIOD_US = 500  # buttons and axes are read at 2 kHz
+FRAME_US = 1000        # one joystick report per full speed USB frame
+SYNC_WINDOW_US = 1000000
+
+
+class Stage:
+    """log2 histogram and percentiles of one stage, in us"""
+
+    def __init__(self, name):
+        self.name = name
+        self.samples = []
+
+    def add(self, value):
+        self.samples.append(value)
+
+    def percentile(self, p):
+        ordered = sorted(self.samples)
+        return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+    def histogram(self):
+        buckets = {}
+        for value in self.samples:
+            bucket = max(0, int(value).bit_length() - 1)
+            buckets[bucket] = buckets.get(bucket, 0) + 1
+        return sorted(buckets.items())
+
+    def report(self, out):
+        if not self.samples:
+            out.write("%s: no samples\n" % self.name)
+            return
+        count = len(self.samples)
+        out.write("%s: %d samples, min %d, p50 %d, p90 %d, p99 %d, max %d us\n" % (
+            self.name, count, min(self.samples), self.percentile(50),
+            self.percentile(90), self.percentile(99), max(self.samples)))
+        for bucket, hits in self.histogram():
+            low = 1 << bucket if bucket else 0
+            out.write("  %6d-%-6d us %7d %s\n" % (
+                low, (2 << bucket) - 1, hits, "#" * max(1, 50 * hits // count)))
+
+
+def fit_offset(points, window):
+    """points are (host time, host time - device time), returns offset(host time)
+    as the least squares line through the smallest offset of each window"""
+    minima = {}
+    for host, offset in points:
+        key = host // window
+        if key not in minima or offset < minima[key][1]:
+            minima[key] = (host, offset)
+    if len(minima) < 2:
+        base = min(offset for _, offset in points)
+        return lambda host: base
+    xs = [host for host, _ in minima.values()]
+    ys = [offset for _, offset in minima.values()]
+    meanX = sum(xs) / len(xs)
+    meanY = sum(ys) / len(ys)
+    slope = sum((x - meanX) * (y - meanY) for x, y in zip(xs, ys)) / sum((x - meanX) ** 2 for x in xs)
+    # a line through the window minima still has points under it, move it down onto the lowest
+    base = min(y - slope * (x - meanX) for x, y in zip(xs, ys))
+    return lambda host: base + slope * (host - meanX)
+
+
+class LatencyStats:
+    def __init__(self, window=SYNC_WINDOW_US):
+        self.window = window
+        self.samples = []  # (arrival us, sequence, device latency us, device send us unwrapped)
+        self.sequence = None
+        self.lastSent = None
+        self.sentHigh = 0
+        self.missed = 0
+
+    def add(self, report, arrival):
+        """report bytes as read from hidraw, arrival in us on the host clock,
+        returns the sequence id and device latency, None for reports without a new input"""
+        if len(report) < LATENCY_OFFSET + struct.calcsize(LATENCY_FORMAT) or report[0] != REPORT_ID:
+            return None
+        sequence, latency, sent = struct.unpack_from(LATENCY_FORMAT, report, LATENCY_OFFSET)
+        if sequence == self.sequence:
+            return None  # axis or button change without a captured input, or a repeat
+        if self.sequence is not None:
+            self.missed += (sequence - self.sequence - 1) & 0xFF
+        # micros() wraps after 71 minutes
+        if self.lastSent is not None and sent < self.lastSent:
+            self.sentHigh += 1 << 32
+        self.lastSent = sent
+        self.sequence = sequence
+        self.samples.append((arrival, sequence, latency, self.sentHigh + sent))
+        return sequence, latency
+
+    def stages(self):
+        device = Stage("capture->queue")
+        usb = Stage("queue->host")
+        total = Stage("capture->host")
+        if self.samples:
+            offset = fit_offset([(arrival, arrival - sent) for arrival, _, _, sent in self.samples], self.window)
+            for arrival, _, latency, sent in self.samples:
+                transfer = max(0, round(arrival - sent - offset(arrival)))
+                device.add(latency)
+                usb.add(transfer)
+                total.add(latency + transfer)
+        return device, usb, total
+
+    def report(self, out):
+        out.write("%d reports, %d sequence ids missed\n" % (len(self.samples), self.missed))
+        for stage in self.stages():
+            stage.report(out)
+
+
+def now_us():
+    return time.monotonic_ns() // 1000
+
+
+class SimulatedGun(threading.Thread):
+    """writes joystick reports into a pipe the way the firmware sends them, each followed by the
+    host time it arrives at: inputs land at random, are read on the next 500 us input pass, queued
+    in the next USB frame and picked up by the next host poll. The device clock runs off the host one"""
+
+    def __init__(self, fd, count, seed, speed):
+        super().__init__(daemon=True)
+        self.fd = fd
+        self.count = count
+        self.random = random.Random(seed)
+        self.speed = speed
+        self.drift = self.random.uniform(-100e-6, 100e-6)
+        self.offset = self.random.randint(0, 1 << 31)
+        self.sent = []  # (sequence, device latency, transfer) the reader has to recover
+
+    def device_time(self, host):
+        return int(host * (1 + self.drift) + self.offset) & 0xFFFFFFFF
+
+    def run(self):
+        clock = 0
+        sequence = 0
+        pollPhase = self.random.randint(0, FRAME_US - 1)
+        for _ in range(self.count):
+            clock += self.random.randint(2000, 20000)  # next button edge or axis step
+            capture = (clock // INPUT_PERIOD_US + 1) * INPUT_PERIOD_US
+            capture += self.random.randint(0, 40)       # where in the pass it was read
+            queued = (capture // FRAME_US + 1) * FRAME_US + self.random.randint(5, 60)
+            poll = ((queued - pollPhase) // FRAME_US + 1) * FRAME_US + pollPhase
+            arrival = poll + int(self.random.expovariate(1 / 80.0)) + 30  # host controller and stack
+            latency = int(self.device_time(queued) - self.device_time(capture)) & 0xFFFF
+            sequence = (sequence + 1) & 0xFF
+            if self.random.random() < 0.002:
+                continue  # lost on the way, the reader has to count it
+            report = struct.pack("<BBhh" + LATENCY_FORMAT[1:] + "hB", REPORT_ID, 1, 512, 512,
+                                 sequence, latency, self.device_time(queued), 0, 0)
+            self.sent.append((sequence, latency, arrival - queued))
+            if self.speed:
+                time.sleep((arrival - clock) / 1e6 / self.speed)
+            os.write(self.fd, report + struct.pack("<Q", arrival))
+            clock = arrival
+        os.close(self.fd)
+
+
+def read_loopback(fd):
+    """a simulated report and the host time it arrived at, a pipe has no report boundaries like hidraw"""
+    data = b""
+    while len(data) < REPORT_SIZE + 8:
+        chunk = os.read(fd, REPORT_SIZE + 8 - len(data))
+        if not chunk:
+            return b"", 0
+        data += chunk
+    return data[:REPORT_SIZE], struct.unpack("<Q", data[REPORT_SIZE:])[0]
+
+
+def read_reports(fd, stats, limit, log, loopback):
+    read = 0
+    while limit is None or read < limit:
+        if loopback:
+            report, arrival = read_loopback(fd)
+        else:
+            report = os.read(fd, 64)
+            arrival = now_us()
+        if not report:
+            break
+        decoded = stats.add(report, arrival)
+        if decoded is None:
+            continue
+        read += 1
+        if log:
+            log.write("%d,%d,%d,%d\n" % (arrival, decoded[0], decoded[1], stats.samples[-1][3]))
+
+
+def check_simulation(stats, gun, count, out):
+    """the simulated gun knows what it sent, anything off is a bug in the tool"""
+    device, usb, _ = stats.stages()
+    expected = [latency for _, latency, _ in gun.sent]
+    transfers = [transfer for _, _, transfer in gun.sent]
+    fastest = min(transfers)
+    errors = sorted(abs(estimate - (transfer - fastest)) for estimate, transfer in zip(usb.samples, transfers))
+    worst = errors[int(len(errors) * 0.99)] if errors else 0
+    missed = count - len(gun.sent)
+    out.write("queue->host error against the simulated transfers: p99 %d us, max %d us\n" % (worst, errors[-1] if errors else 0))
+    if device.samples != expected or stats.missed != missed or worst > 50:
+        out.write("simulation mismatch: %d of %d reports decoded, %d missed, %d expected\n" % (
+            len(device.samples), len(expected), stats.missed, missed))
+        return False
+    out.write("simulation check passed\n")
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("device", nargs="?", help="hidraw node of the gun's joystick interface")
+    parser.add_argument("-n", "--count", type=int, help="stop after this many reports with a new input")
+    parser.add_argument("--log", help="write arrival us, sequence id, device latency us and device send us of each report to a CSV file")
+    parser.add_argument("--window", type=int, default=SYNC_WINDOW_US, help="us of reports the clocks are lined up over")
+    parser.add_argument("--simulate", action="store_true", help="read from a simulated gun instead of a device")
+    parser.add_argument("--seed", type=int, default=1, help="simulated gun random seed")
+    parser.add_argument("--speed", type=float, default=0,
+                        help="simulated gun speed, 1 is real time, 0 (default) sends as fast as the pipe takes them")
+    args = parser.parse_args()
+    if not args.simulate and not args.device:
+        parser.error("a hidraw device or --simulate is needed")
+
+    stats = LatencyStats(args.window)
+    log = open(args.log, "w") if args.log else None
+    if log:
+        log.write("arrival_us,sequence,device_us,sent_us\n")
+    gun = None
+    count = args.count or 1000
+    if args.simulate:
+        fd, gunFd = os.pipe()
+        gun = SimulatedGun(gunFd, count, args.seed, args.speed)
+        gun.start()
+        limit = None
+    else:
+        fd = os.open(args.device, os.O_RDONLY)
+        limit = args.count
+
+    try:
+        read_reports(fd, stats, limit, log, gun is not None)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.close(fd)
+        if log:
+            log.close()
+
+    stats.report(sys.stdout)
+    if gun:
+        gun.join()
+        return 0 if check_simulation(stats, gun, count, sys.stdout) else 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,147 @@
+#include "Host.h"
+#include "Joystick.h"
+#include "SerialParser.h"
+#include <chrono>
+
+//ns per call of the hot paths, on the host build against the stubs.
+//the numbers only compare two builds on the same machine, each run also checks what the calls produced
+//  Bench [iterations]
+
+extern Joystick_ controller;
+void setup();
+void processSerial();
+
+#define BENCH_REPEATS 5  //the fastest of the repeats is reported
+
+//normalize() is protected, a member pointer taken through a subclass reaches it on the sketch's controller
+class NormalizeProbe : public Joystick_ {
+public:
+  static int call(Joystick_& joystick, int16_t value, int16_t physicalMinimum, int16_t physicalMaximum, int16_t logicalMinimum, int16_t logicalMaximum) {
+    return (joystick.*(&NormalizeProbe::normalize))(value, physicalMinimum, physicalMaximum, logicalMinimum, logicalMaximum);
+  }
+};
+
+//each returns the calls it made, negative when their result was wrong
+static long benchSendState(long iterations) {
+  unsigned long sent = hostUsbSentCount;
+  for (long i = 0; i < iterations; i++) {
+    controller.setButton(0, i & 1);
+    controller.setXAxis(i & 1023);
+    controller.sendState();
+  }
+  return hostUsbSentCount - sent == (unsigned long)iterations ? iterations : -1;
+}
+
+static long benchNormalize(long iterations) {
+  if (NormalizeProbe::call(controller, 512, 0, 1023, 0, 1023) != 512
+      || NormalizeProbe::call(controller, 0, 1023, 0, 0, 1023) != 1023
+      || NormalizeProbe::call(controller, 2000, 0, 1023, -32767, 32767) != 32767) {
+    return -1;
+  }
+  volatile long sum = 0;
+  for (long i = 0; i < iterations; i++) {
+    //both directions, in range and clamped
+    sum += NormalizeProbe::call(controller, (i & 2047) - 512, (i & 1) ? 1023 : 0, (i & 1) ? 0 : 1023, -32767, 32767);
+  }
+  return iterations;
+}
+
+static long benchUppackUsbData(long iterations) {
+  PIDReportHandler& handler = DynamicHID().pidReportHandler;
+  handler.FreeAllEffects();
+  USB_FFBReport_CreateNewEffect_Feature_Data_t create = { 5, USB_EFFECT_SINE, 0 };
+  handler.CreateNewEffect(&create);
+  uint8_t id = handler.pidBlockLoad.effectBlockIndex;
+  if (!id) {
+    return -1;
+  }
+
+  //what a driver sends to set up, play and stop a periodic effect
+  USB_FFBReport_SetEffect_Output_Data_t effect = {};
+  effect.reportId = 1;
+  effect.effectBlockIndex = id;
+  effect.effectType = USB_EFFECT_SINE;
+  effect.duration = 500;
+  effect.gain = 255;
+  USB_FFBReport_SetEnvelope_Output_Data_t envelope = { 2, id, 200, 100, 20, 40 };
+  USB_FFBReport_SetPeriodic_Output_Data_t periodic = { 4, id, 10000, 0, 0, 50 };
+  USB_FFBReport_EffectOperation_Output_Data_t start = { 10, id, 1, 1 };
+  USB_FFBReport_EffectOperation_Output_Data_t stop = { 10, id, 3, 0 };
+  USB_FFBReport_DeviceGain_Output_Data_t gain = { 13, 200 };
+  uint8_t reports[6][64];
+  uint16_t lengths[6] = { sizeof(effect), sizeof(envelope), sizeof(periodic), sizeof(start), sizeof(stop), sizeof(gain) };
+  memcpy(reports[0], &effect, sizeof(effect));
+  memcpy(reports[1], &envelope, sizeof(envelope));
+  memcpy(reports[2], &periodic, sizeof(periodic));
+  memcpy(reports[3], &start, sizeof(start));
+  memcpy(reports[4], &stop, sizeof(stop));
+  memcpy(reports[5], &gain, sizeof(gain));
+
+  for (long i = 0; i < iterations; i++) {
+    uint8_t report = i % 6;
+    handler.UppackUsbData(reports[report], lengths[report]);
+  }
+  bool stopped = !(handler.g_EffectStates[id].state & MEFFECTSTATE_PLAYING);
+  handler.FreeAllEffects();
+  return stopped && iterations >= 6 ? iterations : -1;
+}
+
+static long benchProcessSerial(long iterations) {
+  //a game sends a text command or a frame on every shot, the frames are the newer hosts
+  static const char* lines[] = { "setammo 25!", "sethealth 80!", "setffbrecoil 15 2000 80!", "getuniqueid!" };
+  const uint8_t frame[] = { SERIAL_OP_AMMO, 24, 0, SERIAL_OP_HEALTH, 79, 0, SERIAL_OP_USE_AMMO, 1 };
+  long commands = 0;
+  for (long i = 0; i < iterations; i++) {
+    if (i & 1) {
+      hostSerialFrame(frame, sizeof(frame));
+    } else {
+      hostSerialIn(lines[(i >> 1) & 3]);
+    }
+    processSerial();
+    commands++;
+  }
+  hostSerialOut.clear();
+  return hostSerialPending() == 0 && controller.getAmmoCount() > 0 ? commands : -1;
+}
+
+typedef long (*BenchFunction)(long iterations);
+
+typedef struct {
+  const char* name;
+  BenchFunction run;
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+  { "sendState", benchSendState },
+  { "normalize", benchNormalize },
+  { "UppackUsbData", benchUppackUsbData },
+  { "processSerial", benchProcessSerial },
+};
+
+int main(int argc, char** argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+  setup();
+  hostRecording = false;
+
+  int failed = 0;
+  printf("%-16s %10s %10s\n", "", "calls", "ns/call");
+  for (const Benchmark& benchmark : benchmarks) {
+    double best = 0;
+    long calls = 0;
+    for (uint8_t repeat = 0; repeat < BENCH_REPEATS && calls >= 0; repeat++) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      calls = benchmark.run(iterations);
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      if (calls > 0 && (repeat == 0 || ns / calls < best)) {
+        best = ns / calls;
+      }
+    }
+    if (calls < 0) {
+      printf("%-16s wrong result\n", benchmark.name);
+      failed++;
+    } else {
+      printf("%-16s %10ld %10.1f\n", benchmark.name, calls, best);
+    }
+  }
+  return failed ? 1 : 0;
+}
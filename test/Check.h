@@ -0,0 +1,25 @@
+#ifndef CHECK_h
+#define CHECK_h
+
+#include <stdio.h>
+
+//a failed check is printed and counted, main() returns checkResult() so ctest sees it
+
+static int checkFailures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      checkFailures++; \
+    } \
+  } while (0)
+
+static int checkResult() {
+  if (checkFailures) {
+    printf("%d checks failed\n", checkFailures);
+  }
+  return checkFailures ? 1 : 0;
+}
+
+#endif  // CHECK_h
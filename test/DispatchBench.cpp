@@ -0,0 +1,168 @@
+#include "Sketch.h"
+#include "Check.h"
+#include <chrono>
+
+//ns per serial command through runSerialCommand(), for every SERIAL_COMMAND in the sketch.
+//"lookup" sends a name with the same hash that is no command, so it times the jump and the one
+//strcmp_P without the handler, it has to be flat over the table. "command" is the whole call,
+//and each command is checked to have done its job
+//  DispatchBench [iterations]
+
+void runSerialCommand(const char* cmd, uint8_t hash, int16_t arg1, int16_t arg2, int16_t arg3);
+
+#define BENCH_REPEATS 5  //the fastest of the repeats is reported
+
+static bool recoilDone(int16_t value) {
+  bool fired = recoilPhase != 0;
+  //back to idle so the next one goes the whole way again
+  recoilPhase = 0;
+  TCCR1B = 0;
+  return fired == (value == 1);
+}
+static bool ammoCountDone(int16_t value) {
+  return controller.getAmmoCount() == value;
+}
+static bool useAmmoCountDone(int16_t value) {
+  return controller.getUseAmmoCount() == (value > 0);
+}
+static bool healthDone(int16_t value) {
+  return controller.getHealth() == value;
+}
+static bool maxHealthDone(int16_t value) {
+  return controller.getMaxHealth() == value;
+}
+static bool triggerRepeatRateDone(int16_t value) {
+  return controller.getTriggerRepeatRate() == (uint16_t)value;
+}
+static bool triggerHoldTimeDone(int16_t value) {
+  return controller.getTriggerHoldTime() == (uint16_t)value;
+}
+static bool autoRecoilDone(int16_t value) {
+  return controller.getAutoRecoil() == (value > 0);
+}
+static bool ffbRecoilDone(int16_t value) {
+  return DynamicHID().pidReportHandler.ffbRecoil.mode == value;
+}
+static bool profileDone(int16_t value) {
+  return controller.getProfile() == value;
+}
+static bool uniqueIdDone(int16_t value) {
+  return controller.getUniqueId() == (uint16_t)value;
+}
+static bool uniqueIdPrinted(int16_t value) {
+  bool printed = atol(hostSerialOut.c_str()) == controller.getUniqueId();
+  hostSerialOut.clear();
+  return printed;
+}
+
+typedef struct {
+  const char* name;
+  int16_t value[2];  //sent in turn as the first arg
+  bool (*done)(int16_t value);
+} Command;
+
+//in the order of the old strcmp_P chain
+static const Command commands[] = {
+  { "recoil", { 1, 0 }, recoilDone },
+  { "setammocount", { 25, 24 }, ammoCountDone },
+  { "setammo", { 12, 11 }, ammoCountDone },
+  { "useammocount", { 1, 0 }, useAmmoCountDone },
+  { "sethealth", { 80, 79 }, healthDone },
+  { "setmaxhealth", { 100, 99 }, maxHealthDone },
+  { "settriggerrepeatrate", { 120, 100 }, triggerRepeatRateDone },
+  { "settriggerholdtime", { 40, 30 }, triggerHoldTimeDone },
+  { "setautorecoil", { 1, 0 }, autoRecoilDone },
+  { "setffbrecoil", { 15, 3 }, ffbRecoilDone },
+  { "setprofile", { 1, 0 }, profileDone },
+  { "setuniqueid", { 0x1234, 0x4321 }, uniqueIdDone },
+  { "getuniqueid", { 0, 0 }, uniqueIdPrinted },
+};
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+//shortest lowercase name with the same hash that isn't a command
+static bool findDecoy(uint8_t hash, char* decoy) {
+  for (uint8_t length = 1; length <= 3; length++) {
+    for (uint32_t n = 0; n < 17576; n++) {
+      uint32_t letters = n;
+      for (uint8_t i = 0; i < length; i++) {
+        decoy[i] = 'a' + letters % 26;
+        letters /= 26;
+      }
+      decoy[length] = '\0';
+      if (letters || serialCommandHash(decoy) != hash) {
+        continue;
+      }
+      bool taken = false;
+      for (const Command& command : commands) {
+        taken |= strcmp(command.name, decoy) == 0;
+      }
+      if (!taken) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static double nsPerCall(const char* name, const int16_t* value, bool rearmRecoil, long iterations) {
+  uint8_t hash = serialCommandHash(name);
+  double best = 0;
+  for (uint8_t repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+      runSerialCommand(name, hash, value[i & 1], 2000, 80);
+      if (rearmRecoil) {
+        recoilDone(value[i & 1]);
+      }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    if (repeat == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+  setup();
+  hostRecording = false;
+
+  printf("%-22s %5s %10s %10s\n", "", "hash", "lookup ns", "command ns");
+  double fastestLookup = 0;
+  double slowestLookup = 0;
+  for (uint8_t c = 0; c < COMMAND_COUNT; c++) {
+    const Command& command = commands[c];
+    //each value takes effect on its own
+    for (uint8_t v = 0; v < 2; v++) {
+      runSerialCommand(command.name, serialCommandHash(command.name), command.value[v], 2000, 80);
+      if (!command.done(command.value[v])) {
+        printf("%s %d did not take effect\n", command.name, command.value[v]);
+        checkFailures++;
+      }
+    }
+
+    char decoy[4];
+    if (!findDecoy(serialCommandHash(command.name), decoy)) {
+      printf("no name shares the hash of %s\n", command.name);
+      checkFailures++;
+      continue;
+    }
+    bool recoil = command.done == recoilDone;
+    double lookup = nsPerCall(decoy, command.value, recoil, iterations);
+    double call = nsPerCall(command.name, command.value, recoil, iterations);
+    hostSerialOut.clear();
+    printf("%-22s %5u %10.1f %10.1f\n", command.name, serialCommandHash(command.name), lookup, call);
+    if (c == 0 || lookup < fastestLookup) {
+      fastestLookup = lookup;
+    }
+    if (lookup > slowestLookup) {
+      slowestLookup = lookup;
+    }
+  }
+  //a name that is in no case, the switch falls out at once
+  int16_t none[2] = { 0, 0 };
+  printf("%-22s %5u %10.1f\n", "unknown", serialCommandHash("unknown"), nsPerCall("unknown", none, false, iterations));
+  printf("lookup %.1f to %.1f ns over %u commands\n", fastestLookup, slowestLookup, (unsigned)COMMAND_COUNT);
+  return checkResult();
+}
@@ -0,0 +1,223 @@
+#include "Sketch.h"
+#include "EEPROMWriter.h"
+#include "Settings.h"
+#include "Check.h"
+
+//the EE_READY writer against the host EEPROM, which loses every write past hostEepromWriteBudget
+//like a power cut would. a record cut short at any byte has to read back as the one before it or the new one
+
+static void writeBlock(uint16_t address, const void* data, uint16_t length) {
+  eepromWriter.write(address, data, length);
+  hostEepromFinish();
+}
+
+//only the bytes that differ are programmed, in address order
+static void testChangedBytes() {
+  hostEepromErase();
+  uint8_t block[32];
+  for (uint8_t i = 0; i < sizeof(block); i++) {
+    block[i] = i;
+  }
+  hostEepromWrites = 0;
+  writeBlock(100, block, sizeof(block));
+  CHECK(hostEepromWrites == sizeof(block));
+  CHECK(memcmp(&hostEeprom[100], block, sizeof(block)) == 0);
+
+  block[3] = 0x55;
+  block[30] = 0x66;
+  hostEepromWrites = 0;
+  eepromWriter.write(100, block, sizeof(block));
+  CHECK(eepromWriter.busy() && eepromWriter.busy(block));
+  EE_READY_vect();
+  CHECK(hostEepromWrites == 1 && hostEeprom[103] == 0x55 && hostEeprom[130] == 30);
+  hostEepromFinish();
+  CHECK(hostEepromWrites == 2 && hostEeprom[130] == 0x66);
+  CHECK(!eepromWriter.busy());
+
+  //unchanged, nothing is written and the writer is idle after one interrupt
+  hostEepromWrites = 0;
+  writeBlock(100, block, sizeof(block));
+  CHECK(hostEepromWrites == 0);
+}
+
+//a new write() in the middle of one starts over from its first byte
+static void testRestart() {
+  hostEepromErase();
+  uint8_t first[16];
+  uint8_t second[16];
+  memset(first, 0x11, sizeof(first));
+  memset(second, 0x22, sizeof(second));
+  eepromWriter.write(200, first, sizeof(first));
+  for (uint8_t i = 0; i < 5; i++) {
+    EE_READY_vect();
+  }
+  eepromWriter.write(200, second, sizeof(second));
+  hostEepromFinish();
+  CHECK(memcmp(&hostEeprom[200], second, sizeof(second)) == 0);
+}
+
+static bool sameSettings(const Settings& a, const Settings& b) {
+  return memcmp(&a, &b, sizeof(Settings)) == 0;
+}
+
+//every cut point of a save, on a fresh EEPROM and over a record of its own.
+//the profile reads back old or new and the others are untouched
+static void testSettingsPowerCut() {
+  hostEepromErase();
+  Settings saved[SETTINGS_PROFILES];
+  {
+    SettingsEEPROM journal;
+    journal.begin();
+    for (uint8_t profile = 0; profile < SETTINGS_PROFILES; profile++) {
+      saved[profile] = journal.load(profile);
+    }
+    //profile 2 and 3 get a record, 0 and 1 stay on defaults
+    for (uint8_t profile = 2; profile < SETTINGS_PROFILES; profile++) {
+      saved[profile].triggerRepeatRate = 50 + profile;
+      journal.save(profile, saved[profile]);
+      hostEepromFinish();
+    }
+  }
+  uint8_t before[E2END + 1];
+  memcpy(before, hostEeprom, sizeof(before));
+
+  unsigned long cuts = 0;
+  unsigned long older = 0;
+  for (uint8_t profile = 1; profile <= 2; profile++) {
+    Settings next = saved[profile];
+    next.triggerRepeatRate = 200;
+    next.xAxisMinimum = 17;
+    next.recoilPulse.onTime = 12345;
+
+    hostEepromWrites = 0;
+    {
+      SettingsEEPROM journal;
+      journal.begin();
+      journal.save(profile, next);
+      hostEepromFinish();
+    }
+    long total = hostEepromWrites;
+    CHECK(total > 0);
+
+    for (long cut = 0; cut < total; cut++) {
+      memcpy(hostEeprom, before, sizeof(before));
+      hostEepromWrites = 0;
+      hostEepromWriteBudget = cut;
+      {
+        SettingsEEPROM journal;
+        journal.begin();
+        journal.save(profile, next);
+        hostEepromFinish();
+      }
+      hostEepromWriteBudget = -1;
+
+      SettingsEEPROM journal;
+      journal.begin();
+      for (uint8_t other = 0; other < SETTINGS_PROFILES; other++) {
+        Settings loaded = journal.load(other);
+        if (other == profile) {
+          older += sameSettings(loaded, saved[profile]);
+          if (!sameSettings(loaded, saved[profile]) && !sameSettings(loaded, next)) {
+            printf("profile %u cut after %ld of %ld writes reads back neither record\n", profile, cut, total);
+            checkFailures++;
+          }
+        } else if (!sameSettings(loaded, saved[other])) {
+          printf("profile %u cut after %ld of %ld writes changed profile %u\n", profile, cut, total, other);
+          checkFailures++;
+        }
+      }
+      cuts++;
+    }
+  }
+  //a save cut before its crc is in never counts
+  CHECK(older == cuts);
+  printf("%lu power cuts, each read back the previous record\n", cuts);
+}
+
+static void testUniqueIdPowerCut() {
+  hostEepromErase();
+  DeviceEEPROM device;
+  device.saveUniqueId(0x1234);
+  hostEepromFinish();
+  uint8_t before[E2END + 1];
+  memcpy(before, hostEeprom, sizeof(before));
+  for (long cut = 0; cut <= (long)sizeof(device.data); cut++) {
+    memcpy(hostEeprom, before, sizeof(before));
+    hostEepromWrites = 0;
+    hostEepromWriteBudget = cut;
+    device.saveUniqueId(0xBEEF);
+    hostEepromFinish();
+    hostEepromWriteBudget = -1;
+    uint16_t uniqueId = DeviceEEPROM::loadUniqueId();
+    CHECK(uniqueId == 0x1234 || uniqueId == 0xBEEF);
+    CHECK(cut < (long)sizeof(DeviceSettings) || uniqueId == 0xBEEF);
+    CHECK(cut > 0 || uniqueId == 0x1234);
+  }
+}
+
+static unsigned long reportTime(uint8_t id, uint8_t command) {
+  for (const HostTransfer& report : hostUsbSent) {
+    if (report.data[0] == id && report.data[1] == command) {
+      return report.time;
+    }
+  }
+  return 0;
+}
+
+static bool buttonReportedBefore(unsigned long time) {
+  for (const HostTransfer& report : hostUsbSent) {
+    if (report.data[0] == JOYSTICK_DEFAULT_REPORT_ID && (report.data[1] & 1) && report.time < time) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//GUI command 16 in the running sketch: the trigger is still reported while the bytes go out,
+//and the answer comes once the record is whole
+static void testSaveReply() {
+  hostEepromErase();
+  setup();
+  hostReset();
+  USB_GUI_Command rate = { 15, 4, { 77, 0, 0, 0 } };
+  hostUsbOut(&rate, sizeof(rate));
+  sketchRun(1000);
+  USB_GUI_Command save = { 15, 16, { 0, 0, 0, 0 } };
+  hostUsbOut(&save, sizeof(save));
+  hostEepromWrites = 0;
+  unsigned long saveStart = micros();
+  sketchRun(1000);
+  CHECK(eepromWriter.busy());
+  hostSetPin(BTN_TRIGGER, LOW);
+  for (unsigned long ms = 0; ms < 2000 && !reportTime(16, 16); ms++) {
+    sketchRun(1000);
+  }
+  hostSetPin(BTN_TRIGGER, HIGH);
+
+  unsigned long replied = reportTime(16, 16);
+  CHECK(replied != 0);
+  CHECK(!eepromWriter.busy());
+  const HostTransfer* reply = NULL;
+  for (const HostTransfer& report : hostUsbSent) {
+    if (report.data[0] == 16 && report.data[1] == 16) {
+      reply = &report;
+    }
+  }
+  CHECK(reply && reply->data[2] == 1);
+  CHECK(buttonReportedBefore(replied));
+  //a byte takes 3.4ms, the answer waits for all of them
+  CHECK(hostEepromWrites > 0 && replied - saveStart >= (hostEepromWrites - 1) * EEPROM_WRITE_US);
+  SettingsEEPROM journal;
+  journal.begin();
+  CHECK(journal.load(0).triggerRepeatRate == 77);
+  printf("save of %lu bytes answered after %lu ms\n", hostEepromWrites, (replied - saveStart) / 1000);
+}
+
+int main() {
+  testChangedBytes();
+  testRestart();
+  testSettingsPowerCut();
+  testUniqueIdPowerCut();
+  testSaveReply();
+  return checkResult();
+}
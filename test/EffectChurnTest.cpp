@@ -0,0 +1,238 @@
+#include "PIDReportHandler.h"
+#include "Check.h"
+#include <random>
+
+//hours of effects created, started, stopped, paused and freed the way a game's driver does it,
+//with the effect clock started close to its 32 bit wrap. after every tick each effect has to be playing
+//exactly when its own start, delay, duration and loop count say so, and the RAM pool has to add up
+//  EffectChurnTest [hours]
+
+#define TICKS_PER_HOUR (3600UL * 1000 * EFFECT_TICKS_PER_MS)
+
+typedef struct {
+  bool allocated;
+  bool playing;
+  bool infinite;
+  uint32_t stopTime;
+} ModelEffect;
+
+static PIDReportHandler handler;
+static ModelEffect model[MAX_EFFECTS + 1];
+static bool paused = false;
+static uint32_t pausedAt;
+static std::mt19937 random32(27);
+
+static uint32_t randomBelow(uint32_t limit) {
+  return random32() % limit;
+}
+
+static uint8_t randomAllocated() {
+  uint8_t id = 1 + randomBelow(MAX_EFFECTS);
+  return model[id].allocated ? id : 0;
+}
+
+static void create() {
+  USB_FFBReport_CreateNewEffect_Feature_Data_t create = { 5, USB_EFFECT_CONSTANT, 0 };
+  handler.CreateNewEffect(&create);
+  uint8_t id = handler.pidBlockLoad.effectBlockIndex;
+  uint8_t allocated = 0;
+  for (uint8_t i = 1; i <= MAX_EFFECTS; i++) {
+    allocated += model[i].allocated;
+  }
+  if (!id) {
+    CHECK(allocated == MAX_EFFECTS);
+    return;
+  }
+  CHECK(!model[id].allocated);
+  model[id].allocated = true;
+  model[id].playing = false;
+
+  USB_FFBReport_SetEffect_Output_Data_t effect = {};
+  effect.reportId = 1;
+  effect.effectBlockIndex = id;
+  effect.effectType = USB_EFFECT_CONSTANT;
+  effect.duration = randomBelow(8) == 0 ? USB_DURATION_INFINITE : randomBelow(2000);
+  effect.startDelay = randomBelow(4) == 0 ? randomBelow(500) : 0;
+  handler.SetEffect(&effect);
+}
+
+static void start(uint8_t id, uint8_t operation) {
+  volatile TEffectState& effect = handler.g_EffectStates[id];
+  uint8_t loopCount = randomBelow(16) == 0 ? 0xFF : randomBelow(4);
+  USB_FFBReport_EffectOperation_Output_Data_t op = { 10, id, operation, loopCount };
+  if (operation == 2) {
+    for (uint8_t i = 1; i <= MAX_EFFECTS; i++) {
+      model[i].playing = false;
+    }
+  }
+  uint32_t startTime = handler.effectTicks + (uint32_t)effect.startDelay * EFFECT_TICKS_PER_MS;
+  handler.EffectOperation(&op);
+  model[id].playing = true;
+  model[id].infinite = effect.duration >= USB_DURATION_INFINITE || loopCount == 0xFF;
+  model[id].stopTime = startTime + (uint32_t)effect.duration * (loopCount ? loopCount : 1) * EFFECT_TICKS_PER_MS;
+}
+
+//a driver starting a block it never created or already freed, nothing changes
+static void startUnallocated(uint8_t id) {
+  USB_FFBReport_EffectOperation_Output_Data_t op = { 10, id, 1, 1 };
+  handler.EffectOperation(&op);
+}
+
+static void stop(uint8_t id) {
+  USB_FFBReport_EffectOperation_Output_Data_t op = { 10, id, 3, 0 };
+  handler.EffectOperation(&op);
+  model[id].playing = false;
+}
+
+static void freeEffect(uint8_t id) {
+  USB_FFBReport_BlockFree_Output_Data_t free = { 11, id };
+  handler.BlockFree(&free);
+  if (id == 0xFF) {
+    memset(model, 0, sizeof(model));
+  } else {
+    model[id].allocated = false;
+    model[id].playing = false;
+  }
+}
+
+static void control(uint8_t control) {
+  USB_FFBReport_DeviceControl_Output_Data_t report = { 12, control };
+  handler.DeviceControl(&report);
+  if (control == 5 && !paused) {
+    paused = true;
+    pausedAt = handler.effectTicks;
+  } else if (control == 6 && paused) {
+    paused = false;
+    for (uint8_t i = 1; i <= MAX_EFFECTS; i++) {
+      model[i].stopTime += handler.effectTicks - pausedAt;
+    }
+  }
+}
+
+//what a driver does between two ticks, most of the time nothing
+static void churn() {
+  uint32_t roll = randomBelow(1000);
+  if (roll >= 13) {
+    return;
+  }
+  uint8_t id = randomAllocated();
+  if (roll < 3) {
+    create();
+  } else if (roll < 6 && id) {
+    start(id, 1);
+  } else if (roll < 7 && id) {
+    start(id, 2);
+  } else if (roll < 8 && id) {
+    stop(id);
+  } else if (roll < 10 && id) {
+    freeEffect(id);
+  } else if (roll < 11) {
+    control(paused ? 6 : 5);
+  } else if (roll < 12) {
+    uint8_t any = 1 + randomBelow(MAX_EFFECTS);
+    if (!model[any].allocated) {
+      startUnallocated(any);
+    }
+  } else if (randomBelow(50) == 0) {
+    freeEffect(0xFF);
+  }
+}
+
+static bool check() {
+  uint8_t playing = 0;
+  uint8_t allocated = 0;
+  uint32_t now = handler.effectTicks;
+  for (uint8_t id = 1; id <= MAX_EFFECTS; id++) {
+    ModelEffect& effect = model[id];
+    if (effect.playing && !paused && !effect.infinite && (int32_t)(now - effect.stopTime) >= 0) {
+      effect.playing = false;
+    }
+    bool handlerPlaying = handler.g_EffectStates[id].state & MEFFECTSTATE_PLAYING;
+    if (handlerPlaying != effect.playing) {
+      printf("tick %lu effect %u playing %d, expected %d\n", (unsigned long)now, id, handlerPlaying, effect.playing);
+      return false;
+    }
+    playing += effect.playing;
+    allocated += effect.allocated;
+  }
+  if (handler.playingCount != playing) {
+    printf("tick %lu %u effects on the playing list, %u playing\n", (unsigned long)now, handler.playingCount, playing);
+    return false;
+  }
+  if (handler.pidBlockLoad.ramPoolAvailable != MEMORY_SIZE - allocated * SIZE_EFFECT) {
+    printf("tick %lu ram pool %u with %u effects allocated\n", (unsigned long)now, handler.pidBlockLoad.ramPoolAvailable, allocated);
+    return false;
+  }
+  return true;
+}
+
+static uint32_t kicksFor(uint32_t ms) {
+  uint32_t kicks = 0;
+  for (uint32_t tick = 0; tick < ms * EFFECT_TICKS_PER_MS; tick++) {
+    kicks += handler.EffectTick();
+  }
+  return kicks;
+}
+
+//a periodic effect kicks once a period. a pause holds its kicks, and after it they go on at the same
+//rate without making up for the time paused
+static void testPauseKicks() {
+  handler.FreeAllEffects();
+  handler.ffbRecoil.mode = FFB_RECOIL_PERIODIC;
+  handler.ffbRecoil.threshold = 0;
+  handler.ffbRecoil.minPeriod = 0;
+  USB_FFBReport_DeviceControl_Output_Data_t enable = { 12, 1 };
+  handler.DeviceControl(&enable);
+  USB_FFBReport_CreateNewEffect_Feature_Data_t create = { 5, USB_EFFECT_SQUARE, 0 };
+  handler.CreateNewEffect(&create);
+  uint8_t id = handler.pidBlockLoad.effectBlockIndex;
+  USB_FFBReport_SetEffect_Output_Data_t effect = {};
+  effect.reportId = 1;
+  effect.effectBlockIndex = id;
+  effect.effectType = USB_EFFECT_SQUARE;
+  effect.duration = USB_DURATION_INFINITE;
+  effect.gain = 255;
+  handler.SetEffect(&effect);
+  handler.g_EffectStates[id].magnitude = 10000;
+  handler.g_EffectStates[id].period = 100;
+  USB_FFBReport_EffectOperation_Output_Data_t op = { 10, id, 1, 1 };
+  handler.EffectOperation(&op);
+
+  uint32_t before = kicksFor(1050);
+  USB_FFBReport_DeviceControl_Output_Data_t pause = { 12, 5 };
+  handler.DeviceControl(&pause);
+  CHECK(kicksFor(10000) == 0);
+  USB_FFBReport_DeviceControl_Output_Data_t resume = { 12, 6 };
+  handler.DeviceControl(&resume);
+  uint32_t first = kicksFor(40);
+  uint32_t after = first + kicksFor(960);
+  CHECK(before == 11);
+  CHECK(first == 0 && after == 10);
+  printf("periodic kicks: %lu in the second before a 10 s pause, %lu in the second after, %lu right after\n", (unsigned long)before, (unsigned long)after, (unsigned long)first);
+
+  handler.FreeAllEffects();
+  handler.ffbRecoil.mode = 0;
+}
+
+int main(int argc, char** argv) {
+  uint32_t hours = argc > 1 ? atol(argv[1]) : 6;
+  testPauseKicks();
+  handler.FreeAllEffects();
+  //the clock wraps halfway through
+  handler.effectTicks = 0UL - hours * TICKS_PER_HOUR / 2;
+
+  unsigned long starts = 0;
+  for (uint32_t tick = 0; tick < hours * TICKS_PER_HOUR; tick++) {
+    uint8_t playing = handler.playingCount;
+    churn();
+    starts += handler.playingCount > playing;
+    handler.EffectTick();
+    if (!check()) {
+      checkFailures++;
+      break;
+    }
+  }
+  printf("%lu hours, %lu effect starts, clock at %lu\n", (unsigned long)hours, starts, (unsigned long)handler.effectTicks);
+  CHECK(starts > 0);
+  return checkResult();
+}
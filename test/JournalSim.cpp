@@ -0,0 +1,223 @@
+#include "Host.h"
+#include "EEPROMWriter.h"
+#include "Settings.h"
+#include "Check.h"
+#include <util/crc16.h>
+#include <chrono>
+#include <random>
+
+//the settings journal over millions of saves on the host EEPROM: how evenly the ring wears,
+//how much begin() and load() read, and what a journal that keeps losing power mid-save reads back
+//  JournalSim [saves]
+
+#define CELL_ENDURANCE 100000UL  //erase and write cycles the ATmega32U4 datasheet gives per EEPROM cell
+
+static std::mt19937 random32(42);
+
+static bool sameSettings(const Settings& a, const Settings& b) {
+  return memcmp(&a, &b, sizeof(Settings)) == 0;
+}
+
+static void save(SettingsEEPROM& journal, uint8_t profile, const Settings& settings) {
+  if (!journal.save(profile, settings)) {
+    printf("save of profile %u refused\n", profile);
+    checkFailures++;
+  }
+  hostEepromFinish();
+}
+
+//a new journal after a reset reads back what was saved last
+static void checkReload(const Settings* saved) {
+  SettingsEEPROM journal;
+  journal.begin();
+  for (uint8_t profile = 0; profile < SETTINGS_PROFILES; profile++) {
+    if (!sameSettings(journal.load(profile), saved[profile])) {
+      printf("profile %u reads back wrong\n", profile);
+      checkFailures++;
+    }
+  }
+}
+
+//one profile saved over and over, the others never saved or saved once and pinned to their slot
+static void testWear(long saves, bool othersSaved) {
+  hostEepromErase();
+  SettingsEEPROM journal;
+  journal.begin();
+  Settings saved[SETTINGS_PROFILES];
+  for (uint8_t profile = 0; profile < SETTINGS_PROFILES; profile++) {
+    saved[profile] = journal.load(profile);
+    if (othersSaved) {
+      saved[profile].triggerRepeatRate = 10 + profile;
+      save(journal, profile, saved[profile]);
+    }
+  }
+  memset(hostEepromWear, 0, sizeof(hostEepromWear));
+  for (long i = 0; i < saves; i++) {
+    //a recalibration moves a few bytes
+    saved[1].xAxisMinimum = i & 0x3FF;
+    saved[1].xAxisMaximum = 0x3FF - (random32() & 0x3F);
+    save(journal, 1, saved[1]);
+  }
+  checkReload(saved);
+
+  unsigned long most = 0;
+  unsigned long total = 0;
+  uint16_t worn = 0;
+  for (uint16_t address = 0; address < SETTINGS_SLOTS * SETTINGS_SLOT_SIZE; address++) {
+    most = max(most, hostEepromWear[address]);
+    total += hostEepromWear[address];
+    worn += hostEepromWear[address] > 0;
+  }
+  //every save goes to the next slot no profile's newest record holds
+  uint8_t turning = othersSaved ? SETTINGS_SLOTS - (SETTINGS_PROFILES - 1) : SETTINGS_SLOTS;
+  CHECK(most <= (unsigned long)saves / turning + 2);
+  printf("%ld saves, %s: %u cells written, %.1f writes per save, worst cell %lu, wears out after %.0f saves\n",
+         saves, othersSaved ? "3 profiles pinned" : "1 profile", worn, (double)total / saves, most,
+         (double)CELL_ENDURANCE * saves / most);
+}
+
+//what startup and a profile switch read from a full ring
+static void testLoad() {
+  SettingsEEPROM journal;
+  hostEepromReads = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  journal.begin();
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  unsigned long beginReads = hostEepromReads;
+  hostEepromReads = 0;
+  journal.load(1);
+  unsigned long loadReads = hostEepromReads;
+  //begin() reads each slot's header and the newest record of each profile, load() its profile's record
+  //twice, for the crc and the copy
+  CHECK(beginReads <= SETTINGS_SLOTS * sizeof(SettingsRecordHeader) + SETTINGS_PROFILES * SETTINGS_SLOT_SIZE + LEGACY_SETTINGS_SIZE + 1);
+  CHECK(loadReads <= 2 * SETTINGS_SLOT_SIZE);
+  printf("begin() reads %lu bytes in %.0f ns on the host, load() %lu bytes\n", beginReads, ns, loadReads);
+}
+
+//saves of random profiles, the power goes at a random byte of most of them and the journal starts over on what is left.
+//the profile cut reads back old or new, the others never change
+static void testPowerCuts(long trials) {
+  hostEepromErase();
+  Settings saved[SETTINGS_PROFILES];
+  {
+    SettingsEEPROM journal;
+    journal.begin();
+    for (uint8_t profile = 0; profile < SETTINGS_PROFILES; profile++) {
+      saved[profile] = journal.load(profile);
+    }
+  }
+  long kept = 0;
+  long lost = 0;
+  for (long trial = 0; trial < trials; trial++) {
+    uint8_t profile = random32() % SETTINGS_PROFILES;
+    Settings next = saved[profile];
+    next.xAxisMinimum = random32() % 200;
+    next.recoilPulse.onTime = random32();
+    next.recoilThermal.heatLimit = random32();
+
+    hostEepromWrites = 0;
+    hostEepromWriteBudget = random32() % 4 == 0 ? -1 : random32() % 100;
+    {
+      SettingsEEPROM journal;
+      journal.begin();
+      save(journal, profile, next);
+    }
+    hostEepromWriteBudget = -1;
+
+    SettingsEEPROM journal;
+    journal.begin();
+    Settings loaded = journal.load(profile);
+    if (sameSettings(loaded, next)) {
+      saved[profile] = next;
+      kept++;
+    } else if (sameSettings(loaded, saved[profile])) {
+      lost++;
+    } else {
+      printf("trial %ld: profile %u reads back neither record\n", trial, profile);
+      checkFailures++;
+      saved[profile] = loaded;
+    }
+    for (uint8_t other = 0; other < SETTINGS_PROFILES; other++) {
+      if (other != profile && !sameSettings(journal.load(other), saved[other])) {
+        printf("trial %ld: save of profile %u changed profile %u\n", trial, profile, other);
+        checkFailures++;
+      }
+    }
+  }
+  CHECK(kept > 0 && lost > 0);
+  printf("%ld saves with power cuts: %ld whole, %ld fell back to the record before\n", trials, kept, lost);
+}
+
+//a record with a valid crc, as a save of some firmware would leave it
+static void writeRecord(uint8_t slot, SettingsRecordHeader header, const Settings& settings) {
+  uint16_t address = slot * SETTINGS_SLOT_SIZE;
+  memcpy(&hostEeprom[address], &header, sizeof(header));
+  memcpy(&hostEeprom[address + sizeof(header)], &settings, header.length);
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < sizeof(header) + header.length; i++) {
+    crc = _crc16_update(crc, hostEeprom[address + i]);
+  }
+  memcpy(&hostEeprom[address + sizeof(header) + header.length], &crc, sizeof(crc));
+}
+
+//the XOR checksummed block from before the journal, and a record shorter than today's Settings
+static void testMigration() {
+  hostEepromErase();
+  Settings legacy = SettingsEEPROM::getDefaults();
+  strcpy(legacy.id, FIRMWARE_TYPE);
+  legacy.xAxisMinimum = 123;
+  uint8_t block[LEGACY_SETTINGS_SIZE + 1];
+  memcpy(block, &legacy, LEGACY_SETTINGS_SIZE);
+  uint8_t checksum = ~block[0];
+  for (uint8_t i = 1; i < LEGACY_SETTINGS_SIZE; i++) {
+    checksum = checksum ^ ~block[i];
+  }
+  block[LEGACY_SETTINGS_SIZE] = checksum;
+  memcpy(hostEeprom, block, sizeof(block));
+
+  //a version 0 record of profile 3 in the last slot, only the GUI part
+  Settings old = SettingsEEPROM::getDefaults();
+  old.triggerHoldTime = 321;
+  old.recoilPulse.onTime = 1;  //past its length, has to come back as the default
+  writeRecord(SETTINGS_SLOTS - 1, { 7, 3, 0, LEGACY_SETTINGS_SIZE }, old);
+  //newer records of profile 3 that this firmware can't read, one of a later version and a version 0 one longer than the GUI part
+  Settings future = old;
+  future.triggerHoldTime = 999;
+  writeRecord(SETTINGS_SLOTS - 2, { 8, 3, SETTINGS_VERSION + 1, sizeof(Settings) }, future);
+  writeRecord(SETTINGS_SLOTS - 3, { 9, 3, 0, sizeof(Settings) }, future);
+
+  SettingsEEPROM journal;
+  journal.begin();
+  Settings loaded = journal.load(0);
+  CHECK(loaded.xAxisMinimum == 123 && loaded.recoilPulse.onTime == SettingsEEPROM::getDefaults().recoilPulse.onTime);
+  loaded = journal.load(3);
+  CHECK(loaded.triggerHoldTime == 321 && loaded.recoilPulse.onTime == SettingsEEPROM::getDefaults().recoilPulse.onTime);
+
+  //saving another profile keeps the old block, saving profile 0 moves it into the ring
+  Settings other = journal.load(2);
+  other.triggerRepeatRate = 99;
+  save(journal, 2, other);
+  {
+    SettingsEEPROM reset;
+    reset.begin();
+    CHECK(reset.load(0).xAxisMinimum == 123 && reset.load(2).triggerRepeatRate == 99 && reset.load(3).triggerHoldTime == 321);
+  }
+  Settings first = journal.load(0);
+  first.yAxisMinimum = 45;
+  save(journal, 0, first);
+  SettingsEEPROM reset;
+  reset.begin();
+  loaded = reset.load(0);
+  CHECK(loaded.xAxisMinimum == 123 && loaded.yAxisMinimum == 45);
+  CHECK(reset.load(2).triggerRepeatRate == 99 && reset.load(3).triggerHoldTime == 321);
+}
+
+int main(int argc, char** argv) {
+  long saves = argc > 1 ? atol(argv[1]) : 2000000;
+  testWear(saves, false);
+  testWear(saves, true);
+  testLoad();
+  testPowerCuts(max(saves / 100, 1000L));
+  testMigration();
+  return checkResult();
+}
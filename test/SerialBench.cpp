@@ -0,0 +1,157 @@
+#include "Host.h"
+#include "Joystick.h"
+#include "SerialParser.h"
+#include "Check.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+//the serial parser fed a recorded MAMEHooker session, whole and in the pieces USB CDC hands it over in.
+//throughput is ns per byte with everything already arrived. latency is how long the slowest processSerial() passes take
+//when the bytes trickle in, a pass has to take what is there and return without waiting for the rest.
+//the commands parsed have to be the ones the old readStringUntil and sscanf parser found
+//  SerialBench [sessions]
+
+extern Joystick_ controller;
+void setup();
+void processSerial();
+
+//Time Crisis 2 through MAMEHooker, start of a stage: the outputs as they were written to the port
+static const char capture[] =
+  "setmaxhealth 4!sethealth 4!setammo 6!useammocount 1!setautorecoil 0!\r\n"
+  "recoil 1!setammo 5!recoil 0!recoil 1!setammo 4!recoil 0!"
+  "recoil 1!setammo 3!recoil 0!sethealth 3!"
+  "recoil 1!setammo 2!recoil 0!recoil 1!setammo 1!recoil 0!"
+  "recoil 1!setammo 0!recoil 0!setammo 6!\r\n"
+  "SetFfbRecoil 15 2000 80!recoil 1!setammo 5!recoil 0!"
+  "recoil 1!setammo 4!recoil 0!sethealth 2!sethealth 1!"
+  "settriggerrepeatrate 120!settriggerholdtime 40!"
+  "recoil 1!setammo 3!recoil 0!recoil 1!setammo 2!recoil 0!"
+  "sethealth 0!setammo 0!sethealth 4!setammo 6!getuniqueid!\r\n";
+
+#define CHUNK_MAX 16  //CDC hands bytes over in pieces, a full 64 byte packet rarely starts on a line
+
+typedef struct {
+  std::string name;
+  int16_t arg[SERIAL_ARG_COUNT];
+} ParsedCommand;
+
+//what the old parser made of the capture: lowercase, up to '!', then sscanf
+static std::vector<ParsedCommand> referenceParse(const char* text) {
+  std::vector<ParsedCommand> commands;
+  std::string rest(text);
+  size_t end;
+  while ((end = rest.find('!')) != std::string::npos) {
+    std::string line = rest.substr(0, end);
+    rest = rest.substr(end + 1);
+    for (char& c : line) {
+      c = tolower(c);
+    }
+    char name[32];
+    int arg[SERIAL_ARG_COUNT] = { SERIAL_ARG_NONE, SERIAL_ARG_NONE, SERIAL_ARG_NONE };
+    if (sscanf(line.c_str(), "%31s %d %d %d", name, &arg[0], &arg[1], &arg[2]) >= 1) {
+      ParsedCommand command = { name, { (int16_t)arg[0], (int16_t)arg[1], (int16_t)arg[2] } };
+      commands.push_back(command);
+    }
+  }
+  return commands;
+}
+
+static bool sameCommand(const ParsedCommand& a, const ParsedCommand& b) {
+  return a.name == b.name && a.arg[0] == b.arg[0] && a.arg[1] == b.arg[1] && a.arg[2] == b.arg[2];
+}
+
+//the parser alone, in random pieces
+static void testParse(std::mt19937& random32) {
+  std::vector<ParsedCommand> expected = referenceParse(capture);
+  std::vector<ParsedCommand> parsed;
+  SerialParser parser;
+  size_t length = strlen(capture);
+  for (size_t i = 0; i < length;) {
+    size_t chunk = min(length - i, (size_t)(1 + random32() % CHUNK_MAX));
+    for (size_t end = i + chunk; i < end; i++) {
+      if (parser.feed(capture[i]) == SERIAL_PARSED_COMMAND) {
+        ParsedCommand command = { parser.command(), { parser.arg[0], parser.arg[1], parser.arg[2] } };
+        parsed.push_back(command);
+      }
+    }
+  }
+  CHECK(parsed.size() == expected.size());
+  for (size_t i = 0; i < parsed.size() && i < expected.size(); i++) {
+    if (!sameCommand(parsed[i], expected[i])) {
+      printf("command %u parsed as %s %d %d %d, expected %s %d %d %d\n", (unsigned)i,
+             parsed[i].name.c_str(), parsed[i].arg[0], parsed[i].arg[1], parsed[i].arg[2],
+             expected[i].name.c_str(), expected[i].arg[0], expected[i].arg[1], expected[i].arg[2]);
+      checkFailures++;
+    }
+  }
+}
+
+//the end of the capture is what the sketch has to be left with
+static void checkSketchState() {
+  CHECK(controller.getAmmoCount() == 6);
+  CHECK(controller.getHealth() == 4);
+  CHECK(controller.getTriggerRepeatRate() == 120);
+  CHECK(hostSerialOut.find("\r\n") != std::string::npos);
+  hostSerialOut.clear();
+}
+
+static double throughput(long sessions) {
+  size_t length = strlen(capture);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (long i = 0; i < sessions; i++) {
+    hostSerialIn(capture, length);
+    processSerial();
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  CHECK(hostSerialPending() == 0);
+  checkSketchState();
+  return ns / (sessions * length);
+}
+
+//ns of every pass, sorted
+static std::vector<double> passTimes(long sessions, std::mt19937& random32) {
+  size_t length = strlen(capture);
+  std::vector<double> times;
+  for (long s = 0; s < sessions; s++) {
+    for (size_t i = 0; i < length;) {
+      size_t chunk = min(length - i, (size_t)(1 + random32() % CHUNK_MAX));
+      hostSerialIn(&capture[i], chunk);
+      i += chunk;
+      unsigned long before = micros();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      processSerial();
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      //a pass takes what has arrived and never waits on the clock for more
+      if (hostSerialPending() != 0 || micros() != before) {
+        printf("pass left %u bytes, waited %lu us\n", (unsigned)hostSerialPending(), micros() - before);
+        checkFailures++;
+        return times;
+      }
+      times.push_back(ns);
+    }
+  }
+  checkSketchState();
+  std::sort(times.begin(), times.end());
+  return times;
+}
+
+int main(int argc, char** argv) {
+  long sessions = argc > 1 ? atol(argv[1]) : 10000;
+  std::mt19937 random32(31);
+  setup();
+  hostRecording = false;
+
+  testParse(random32);
+  double perByte = throughput(sessions);
+  std::vector<double> times = passTimes(sessions, random32);
+  printf("%u byte session, %u commands\n", (unsigned)strlen(capture), (unsigned)referenceParse(capture).size());
+  printf("throughput %.1f ns/byte, %.0f commands/ms\n", perByte, referenceParse(capture).size() / (perByte * strlen(capture)) * 1e6);
+  if (!times.empty()) {
+    //the host gets preempted now and then, the 99th percentile is the parser's own worst case
+    printf("pass of up to %d bytes: 99%% within %.0f ns, worst %.0f ns\n", CHUNK_MAX, times[times.size() * 99 / 100], times.back());
+  }
+  return checkResult();
+}
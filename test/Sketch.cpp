@@ -0,0 +1,45 @@
+#include "Sketch.h"
+
+static unsigned long eepromReady = 0;
+static bool timer1Pending = false;
+static unsigned long timer1Wait = 0;
+unsigned long sketchTimer1Latency = 0;
+
+void sketchRun(unsigned long us) {
+  for (unsigned long t = 0; t < us; t += SKETCH_STEP_US) {
+    hostAdvance(SKETCH_STEP_US);
+    //CTC mode, the counter clears on the tick after it equals OCR1A. one set below the counter
+    //is missed until the counter wraps, like on the chip
+    if (TCCR1B & ((1 << CS12) | (1 << CS11) | (1 << CS10))) {
+      if (TCNT1 == OCR1A) {
+        TCNT1 = 0;
+        //the flag stays set until the interrupt runs, a match meanwhile adds nothing
+        if ((TIMSK1 & (1 << OCIE1A)) && !timer1Pending) {
+          timer1Pending = true;
+          timer1Wait = sketchTimer1Latency;
+        }
+      } else {
+        TCNT1++;
+      }
+    }
+    if (timer1Pending) {
+      if (timer1Wait == 0) {
+        timer1Pending = false;
+        TIMER1_COMPA_vect();
+      } else {
+        timer1Wait--;
+      }
+    }
+    if ((TIMSK3 & (1 << OCIE3A)) && micros() % WHEEL_TICK_US == 0) {
+      TIMER3_COMPA_vect();
+    }
+    if ((EECR & (1 << EERIE)) && (long)(micros() - eepromReady) >= 0) {
+      unsigned long writes = hostEepromWrites;
+      EE_READY_vect();
+      if (hostEepromWrites != writes) {
+        eepromReady = micros() + EEPROM_WRITE_US;
+      }
+    }
+    loop();
+  }
+}
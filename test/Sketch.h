@@ -0,0 +1,32 @@
+#ifndef SKETCH_h
+#define SKETCH_h
+
+#include "Host.h"
+#include "Joystick.h"
+#include "TimerWheel.h"
+#include "SerialParser.h"
+
+//the parts of RailGunInterface.ino the tests reach, and a way to run it against the host clock
+
+#define SKETCH_STEP_US 4  //one Timer1 tick, Timer3 fires every 50 steps
+#define EEPROM_WRITE_US 3400  //erase and write of one EEPROM byte, EE_READY fires once it is done
+
+extern Joystick_ controller;
+extern TimerWheel timerWheel;
+extern volatile uint8_t recoilPhase;
+
+void setup();
+void loop();
+void processSerial();
+extern "C" void TIMER1_COMPA_vect(void);
+extern "C" void TIMER3_COMPA_vect(void);
+extern "C" void EE_READY_vect(void);
+
+//ticks the Timer1 compare interrupt runs after its match, as if a long Timer3 interrupt held it off
+extern unsigned long sketchTimer1Latency;
+
+//loop() between the interrupts, Timer3 every 200us, Timer1 on its compare match while its clock runs
+//and EE_READY while it is enabled and no byte is programming
+void sketchRun(unsigned long us);
+
+#endif  // SKETCH_h
@@ -0,0 +1,198 @@
+#include "Sketch.h"
+#include "Check.h"
+
+//the sketch end to end through the stubs: enumeration, a trigger pull, a GUI command and a serial command
+
+#define HID_INTERFACE 2  //after the two CDC interfaces
+#define GET_DESCRIPTOR 6
+
+static const HostTransfer* lastReport(uint8_t id) {
+  for (size_t i = hostUsbSent.size(); i > 0; i--) {
+    if (hostUsbSent[i - 1].data[0] == id) {
+      return &hostUsbSent[i - 1];
+    }
+  }
+  return NULL;
+}
+
+static bool buttonReported(uint8_t mask) {
+  for (const HostTransfer& report : hostUsbSent) {
+    if (report.data[0] == JOYSTICK_DEFAULT_REPORT_ID && (report.data[1] & mask)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool pinWritten(uint8_t pin, uint8_t value) {
+  for (const HostPinWrite& write : hostPinWrites) {
+    if (write.pin == pin && write.value == value) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void testEnumeration() {
+  hostReset();
+  //the report descriptor goes out in pieces, their total is the size given in the HID descriptor
+  USBSetup setup = { REQUEST_DEVICETOHOST_STANDARD_INTERFACE, GET_DESCRIPTOR, 0, DYNAMIC_HID_REPORT_DESCRIPTOR_TYPE, HID_INTERFACE, 0x400 };
+  int total = PluggableUSB().getDescriptor(setup);
+  CHECK(total > 0);
+  size_t sent = 0;
+  for (const HostTransfer& transfer : hostControlSent) {
+    sent += transfer.data.size();
+  }
+  CHECK(sent == (size_t)total);
+
+  hostControlSent.clear();
+  CHECK(hostControl(REQUEST_DEVICETOHOST_CLASS_INTERFACE, DYNAMIC_HID_GET_REPORT, 7, DYNAMIC_HID_REPORT_TYPE_FEATURE, HID_INTERFACE, sizeof(USB_FFBReport_PIDPool_Feature_Data_t)));
+  CHECK(hostControlSent.size() == 1);
+  USB_FFBReport_PIDPool_Feature_Data_t pool;
+  memcpy(&pool, hostControlSent[0].data.data(), sizeof(pool));
+  CHECK(pool.reportId == 7 && pool.maxSimultaneousEffects == MAX_EFFECTS);
+
+  //create new effect, then the block load report says where it went
+  USB_FFBReport_CreateNewEffect_Feature_Data_t create = { 5, USB_EFFECT_CONSTANT, 0 };
+  hostControlOut(&create, sizeof(create));
+  CHECK(hostControl(REQUEST_HOSTTODEVICE_CLASS_INTERFACE, DYNAMIC_HID_SET_REPORT, 5, DYNAMIC_HID_REPORT_TYPE_FEATURE, HID_INTERFACE, sizeof(create)));
+  hostControlSent.clear();
+  CHECK(hostControl(REQUEST_DEVICETOHOST_CLASS_INTERFACE, DYNAMIC_HID_GET_REPORT, 6, DYNAMIC_HID_REPORT_TYPE_FEATURE, HID_INTERFACE, sizeof(USB_FFBReport_PIDBlockLoad_Feature_Data_t)));
+  CHECK(hostControlSent.size() == 1);
+  USB_FFBReport_PIDBlockLoad_Feature_Data_t blockLoad;
+  memcpy(&blockLoad, hostControlSent[0].data.data(), sizeof(blockLoad));
+  CHECK(blockLoad.reportId == 6 && blockLoad.effectBlockIndex != 0 && blockLoad.loadStatus == 1);
+}
+
+static void testTrigger() {
+  hostReset();
+  hostSetPin(BTN_TRIGGER, LOW);
+  sketchRun(100000);
+  //auto recoil is on by default, so the pull fires the solenoid and the light along with the button
+  CHECK(pinWritten(RECOIL_RELAY_PIN, HIGH));
+  CHECK(pinWritten(LIGHT_RELAY_PIN, HIGH));
+  CHECK(buttonReported(1));
+
+  hostSetPin(BTN_TRIGGER, HIGH);
+  sketchRun(300000);
+  const HostTransfer* report = lastReport(JOYSTICK_DEFAULT_REPORT_ID);
+  CHECK(report && !(report->data[1] & 1));
+  CHECK(recoilPhase == 0);
+  CHECK(!hostPinWrites.empty() && pinWritten(RECOIL_RELAY_PIN, LOW));
+}
+
+static void testGuiCommand() {
+  hostReset();
+  //command 4 sets the trigger repeat rate and answers with report 16
+  USB_GUI_Command command = { 15, 4, { 120, 0, 0, 0 } };
+  hostUsbOut(&command, sizeof(command));
+  sketchRun(2000);
+  CHECK(controller.getTriggerRepeatRate() == 120);
+  const HostTransfer* report = lastReport(16);
+  CHECK(report && report->data[1] == 4);
+}
+
+//command 22 pushes the joystick state like the serial setmaxhealth does
+static void testGuiMaxHealth() {
+  hostReset();
+  sketchRun(20000);
+  hostUsbSent.clear();
+  USB_GUI_Command command = { 15, 22, { 150, 0, 0, 0 } };
+  hostUsbOut(&command, sizeof(command));
+  sketchRun(20000);
+  CHECK(controller.getMaxHealth() == 150);
+  CHECK(lastReport(JOYSTICK_DEFAULT_REPORT_ID) != NULL);
+}
+
+static void testSerial() {
+  hostReset();
+  hostSerialIn("setammo 17!");
+  uint8_t frame[] = { SERIAL_OP_HEALTH, 42, 0 };
+  hostSerialFrame(frame, sizeof(frame));
+  sketchRun(1000);
+  CHECK(controller.getAmmoCount() == 17);
+  CHECK(controller.getHealth() == 42);
+  CHECK(hostSerialPending() == 0);
+}
+
+//the compare interrupt held off for longer than the lockout, the lockout still ends in time
+//instead of the counter running on to 0xFFFF past a compare it had already passed
+static void testLateCompare() {
+  hostReset();
+  uint16_t onTime = controller.getRecoilOnTime();
+  uint16_t offTime = controller.getRecoilOffTime();
+  controller.setRecoilPulse(1000, 100);
+  sketchTimer1Latency = 50;  //200us, a Timer3 interrupt busy with USB
+  pressFire(true, false);
+  sketchRun(3000);
+  CHECK(recoilPhase == 0);
+  sketchTimer1Latency = 0;
+  controller.setRecoilPulse(onTime, offTime);
+}
+
+//a 2 ms kick and a 20 ms half duty hold with the compare interrupt held off for latency ticks.
+//the shot keeps its length and the thermal model gets the time the relay was actually on
+static void runLateHold(unsigned long latency, unsigned long& shotUs, unsigned long& onUs, unsigned long& heatUs) {
+  hostReset();
+  controller.setRecoilStep(1, 0, RECOIL_DUTY_FULL, 2000);
+  controller.setRecoilStep(1, 1, 128, 20000);
+  controller.setRecoilStep(1, 2, 0, 0);
+  controller.setRecoilShots(1, 1);
+  controller.setRecoilPattern(1);
+  controller.recoilThermal.settings.coolingTime = 600;  //no cooling to speak of over one shot
+  uint32_t heatBefore = controller.recoilThermal.getHeat();
+
+  sketchTimer1Latency = latency;
+  unsigned long start = micros();
+  pressFire(true, false);
+  shotUs = 0;
+  while (!shotUs && micros() - start < 100000) {
+    sketchRun(SKETCH_STEP_US);
+    if (recoilPhase != 1) {
+      shotUs = micros() - start;
+    }
+  }
+  sketchTimer1Latency = 0;
+  sketchRun(100000);
+  controller.setRecoilPattern(RECOIL_PATTERN_PULSE);
+
+  onUs = 0;
+  unsigned long onSince = 0;
+  bool on = false;
+  for (const HostPinWrite& write : hostPinWrites) {
+    if (write.pin != RECOIL_RELAY_PIN || write.value == on) {
+      continue;
+    }
+    on = write.value;
+    if (on) {
+      onSince = write.time;
+    } else {
+      onUs += write.time - onSince;
+    }
+  }
+  heatUs = (controller.recoilThermal.getHeat() - heatBefore) * RECOIL_TIMER_US;
+  CHECK(shotUs && shotUs <= 22000 + 2 * latency * SKETCH_STEP_US);
+  CHECK(heatUs + 2 * RECOIL_TIMER_US >= onUs && heatUs <= onUs + 2 * RECOIL_TIMER_US);
+  printf("held off %lu us: shot %lu us, relay on %lu us, heat %lu us\n", latency * SKETCH_STEP_US, shotUs, onUs, heatUs);
+}
+
+static void testLateHold() {
+  unsigned long shotUs, onUs, heatUs;
+  //shorter than a PWM level, every switch is as late and the duty holds
+  runLateHold(20, shotUs, onUs, heatUs);
+  CHECK(onUs > 11500 && onUs < 12500);
+  //longer than both levels of a period, the ones already over are skipped
+  runLateHold(30, shotUs, onUs, heatUs);
+}
+
+int main() {
+  setup();
+  testEnumeration();
+  testTrigger();
+  testGuiCommand();
+  testGuiMaxHealth();
+  testSerial();
+  testLateCompare();
+  testLateHold();
+  return checkResult();
+}
@@ -0,0 +1,258 @@
+#include "Sketch.h"
+#include "Check.h"
+#include <random>
+#include <vector>
+
+//TIME_SYNC and FIRE_AT over a transport that delays every message by a random few ms, like USB CDC
+//batching does. the host clock runs off the device clock by an offset and a drift and wraps early on.
+//a shot sent ahead with FIRE_AT has to hit the relay within a wheel tick of the intended time, late by
+//no more than the least transport delay the offset estimate saw. "recoil 1!" sent at the intended time
+//is shown for comparison, it is late by the whole delay
+
+#define HOST_START 0xFFF00000UL  //host clock in us when the device's reads 0, it wraps a second in
+#define DRIFT_PPM 30             //host crystal against the device's
+#define TRANSPORT_MIN_US 150
+#define TRANSPORT_JITTER_US 3000
+#define SYNC_PERIOD_US 50000UL
+#define FIRE_LEAD_US 20000UL   //a FIRE_AT goes out this long before its shot
+#define SHOT_PERIOD_US 150000UL  //more than a shot and its lockout
+#define SHOTS 40
+#define SYNC_WINDOW 16         //TIME_SYNC_WINDOW in the sketch
+#define SCHEDULED_SHOTS 4       //SCHEDULED_RECOIL_COUNT in the sketch
+#define POLL_SLACK_US (8 * SKETCH_STEP_US)  //loop() passes before processSerial() reads a frame
+
+typedef struct {
+  unsigned long deliverAt;  //device time
+  std::vector<uint8_t> payload;
+  bool frame;               //else text
+} Message;
+
+static std::mt19937 random32(34);
+static std::vector<Message> inFlight;
+static unsigned long lastDelivery = 0;
+static bool syncing = false;
+static unsigned long nextSync = 0;
+static std::vector<uint32_t> syncSent;  //host time of each TIME_SYNC
+static std::vector<long> syncDelay;         //read at device time minus sent at, per answered TIME_SYNC
+static SerialParser replyParser;
+
+//clocks are 32 bit like on the AVR
+static uint32_t hostTime() {
+  return HOST_START + (uint32_t)(micros() * (1 + DRIFT_PPM * 1e-6));
+}
+
+static uint32_t deviceTimeOf(uint32_t host) {
+  return (uint32_t)((uint32_t)(host - HOST_START) / (1 + DRIFT_PPM * 1e-6) + 0.5);
+}
+
+static void put32(std::vector<uint8_t>& payload, uint32_t value) {
+  for (uint8_t b = 0; b < 4; b++) {
+    payload.push_back(value >> (8 * b));
+  }
+}
+
+static uint32_t get32(const uint8_t* data) {
+  return data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+//the port keeps the order, a message is never delivered before the one sent ahead of it
+static void send(const std::vector<uint8_t>& payload, bool frame) {
+  unsigned long delay = TRANSPORT_MIN_US + random32() % TRANSPORT_JITTER_US;
+  Message message = { max(micros() + delay, lastDelivery), payload, frame };
+  lastDelivery = message.deliverAt;
+  inFlight.push_back(message);
+}
+
+static void sendTimeSync() {
+  std::vector<uint8_t> payload(1, SERIAL_OP_TIME_SYNC);
+  uint32_t now = hostTime();
+  put32(payload, now);
+  syncSent.push_back(now);
+  send(payload, true);
+}
+
+static void sendFireAt(const std::vector<uint32_t>& targets) {
+  std::vector<uint8_t> payload;
+  for (uint32_t target : targets) {
+    payload.push_back(SERIAL_OP_FIRE_AT);
+    put32(payload, target);
+  }
+  send(payload, true);
+}
+
+//answer frames from the sketch, TIME_SYNC answers are taken in as delays
+static std::vector<std::vector<uint8_t> > readReplies() {
+  std::vector<std::vector<uint8_t> > replies;
+  for (char c : hostSerialOut) {
+    if (replyParser.feed(c) == SERIAL_PARSED_FRAME) {
+      const uint8_t* frame = replyParser.frame();
+      if (frame[0] == SERIAL_OP_TIME_SYNC && replyParser.frameLength() == 9) {
+        syncDelay.push_back((int32_t)(get32(&frame[5]) - deviceTimeOf(get32(&frame[1]))));
+      } else {
+        replies.push_back(std::vector<uint8_t>(frame, frame + replyParser.frameLength()));
+      }
+    }
+  }
+  hostSerialOut.clear();
+  return replies;
+}
+
+static std::vector<std::vector<uint8_t> > replies;
+
+static void run(unsigned long us) {
+  unsigned long end = micros() + us;
+  while ((long)(micros() - end) < 0) {
+    if (syncing && (long)(micros() - nextSync) >= 0) {
+      sendTimeSync();
+      nextSync += SYNC_PERIOD_US;
+    }
+    while (!inFlight.empty() && (long)(micros() - inFlight.front().deliverAt) >= 0) {
+      if (inFlight.front().frame) {
+        hostSerialFrame(inFlight.front().payload.data(), inFlight.front().payload.size());
+      } else {
+        hostSerialIn(inFlight.front().payload.data(), inFlight.front().payload.size());
+      }
+      inFlight.erase(inFlight.begin());
+    }
+    sketchRun(SKETCH_STEP_US);
+    if (!hostSerialOut.empty()) {
+      std::vector<std::vector<uint8_t> > read = readReplies();
+      replies.insert(replies.end(), read.begin(), read.end());
+    }
+  }
+}
+
+//times the relay went on since the write index given
+static std::vector<unsigned long> relayOn(size_t from) {
+  std::vector<unsigned long> on;
+  for (size_t i = from; i < hostPinWrites.size(); i++) {
+    if (hostPinWrites[i].pin == RECOIL_RELAY_PIN && hostPinWrites[i].value == HIGH) {
+      on.push_back(hostPinWrites[i].time);
+    }
+  }
+  return on;
+}
+
+static bool fireAtReply(const std::vector<uint8_t>& reply, uint8_t status, uint32_t target) {
+  return reply.size() == 6 && reply[0] == SERIAL_OP_FIRE_AT && reply[1] == status && get32(&reply[2]) == target;
+}
+
+static void testNoSync() {
+  size_t writes = hostPinWrites.size();
+  uint32_t target = hostTime() + FIRE_LEAD_US;
+  sendFireAt(std::vector<uint32_t>(1, target));
+  run(FIRE_LEAD_US + TRANSPORT_MIN_US + TRANSPORT_JITTER_US);
+  CHECK(replies.size() == 1 && fireAtReply(replies[0], FIRE_AT_NO_SYNC, target));
+  CHECK(relayOn(writes).empty());
+  replies.clear();
+}
+
+//the most a window's offset can be above the true one: the smallest delay in the worst window
+static long worstWindowDelay() {
+  long worst = 0;
+  for (size_t start = 0; start + SYNC_WINDOW <= syncDelay.size(); start += SYNC_WINDOW) {
+    long least = syncDelay[start];
+    for (size_t i = start; i < start + SYNC_WINDOW; i++) {
+      least = min(least, syncDelay[i]);
+    }
+    worst = max(worst, least);
+  }
+  return worst;
+}
+
+static void testFireAt() {
+  syncing = true;
+  nextSync = micros();
+  run(SYNC_WINDOW * SYNC_PERIOD_US + SYNC_PERIOD_US / 2);
+  //every TIME_SYNC is answered, with the host time it carried
+  CHECK(syncDelay.size() == SYNC_WINDOW + 1);
+
+  size_t writes = hostPinWrites.size();
+  std::vector<unsigned long> intended;
+  for (uint8_t shot = 0; shot < SHOTS; shot++) {
+    uint32_t target = hostTime() + FIRE_LEAD_US;
+    intended.push_back(deviceTimeOf(target));
+    sendFireAt(std::vector<uint32_t>(1, target));
+    run(SHOT_PERIOD_US);
+  }
+  CHECK(syncDelay.size() == syncSent.size() - inFlight.size());
+
+  std::vector<unsigned long> on = relayOn(writes);
+  CHECK(on.size() == SHOTS);
+  CHECK(replies.size() == SHOTS);
+  for (const std::vector<uint8_t>& reply : replies) {
+    CHECK(reply.size() == 6 && reply[1] == FIRE_AT_SCHEDULED);
+  }
+  replies.clear();
+
+  //the wheel fires within a tick either side, and the offset is high by the least delay of its window
+  long drift = (long)(SYNC_WINDOW * 2 * SYNC_PERIOD_US * DRIFT_PPM / 1000000);
+  long early = WHEEL_TICK_US + drift;
+  long late = worstWindowDelay() + WHEEL_TICK_US + POLL_SLACK_US + drift;
+  long least = 0x7FFFFFFF;
+  long most = -0x7FFFFFFF;
+  long total = 0;
+  for (size_t i = 0; i < on.size() && i < intended.size(); i++) {
+    long error = (int32_t)(on[i] - intended[i]);
+    if (error < -early || error > late) {
+      printf("shot %u at %ld us off, allowed %ld to %ld\n", (unsigned)i, error, -early, late);
+      checkFailures++;
+    }
+    least = min(least, error);
+    most = max(most, error);
+    total += error;
+  }
+  printf("FIRE_AT     %2u shots %6ld us mean, %6ld to %6ld us\n", (unsigned)on.size(), on.empty() ? 0 : total / (long)on.size(), least, most);
+}
+
+//five shots in one frame, a fifth won't fit
+static void testFull() {
+  run(SHOT_PERIOD_US);
+  size_t writes = hostPinWrites.size();
+  std::vector<uint32_t> targets;
+  for (uint8_t shot = 0; shot <= SCHEDULED_SHOTS; shot++) {
+    targets.push_back(hostTime() + FIRE_LEAD_US + shot * SHOT_PERIOD_US);
+  }
+  sendFireAt(targets);
+  run((SCHEDULED_SHOTS + 1) * SHOT_PERIOD_US);
+  CHECK(replies.size() == targets.size());
+  for (size_t i = 0; i < replies.size() && i < targets.size(); i++) {
+    CHECK(fireAtReply(replies[i], i < SCHEDULED_SHOTS ? FIRE_AT_SCHEDULED : FIRE_AT_FULL, targets[i]));
+  }
+  CHECK(relayOn(writes).size() == SCHEDULED_SHOTS);
+  replies.clear();
+}
+
+//the old way, fired on receipt
+static void testImmediate() {
+  size_t writes = hostPinWrites.size();
+  std::vector<unsigned long> intended;
+  for (uint8_t shot = 0; shot < SHOTS; shot++) {
+    intended.push_back(micros());
+    const char* line = "recoil 1!";
+    send(std::vector<uint8_t>(line, line + strlen(line)), false);
+    run(SHOT_PERIOD_US);
+  }
+  std::vector<unsigned long> on = relayOn(writes);
+  CHECK(on.size() == SHOTS);
+  long least = 0x7FFFFFFF;
+  long most = -0x7FFFFFFF;
+  long total = 0;
+  for (size_t i = 0; i < on.size() && i < intended.size(); i++) {
+    long error = (int32_t)(on[i] - intended[i]);
+    least = min(least, error);
+    most = max(most, error);
+    total += error;
+  }
+  printf("recoil 1!   %2u shots %6ld us mean, %6ld to %6ld us\n", (unsigned)on.size(), on.empty() ? 0 : total / (long)on.size(), least, most);
+}
+
+int main() {
+  setup();
+  hostReset();
+  testNoSync();
+  testFireAt();
+  testFull();
+  testImmediate();
+  return checkResult();
+}
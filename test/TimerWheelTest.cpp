@@ -0,0 +1,172 @@
+#include "TimerWheel.h"
+#include "Check.h"
+#include <random>
+#include <vector>
+
+//the timer wheel on its own, ticked by hand: a few thousand timers far past one turn of the slots,
+//some in the interrupt and some deferred, some cancelled, some rearmed from their callbacks
+
+#define TIMER_COUNT 2000
+#define DEFER_EVERY 5  //ticks between runDeferred() calls, a busy loop()
+
+typedef struct {
+  uint32_t due;
+  bool cancelled;
+  uint16_t fired;
+} Expected;
+
+typedef struct {
+  uint32_t tick;
+  int id;
+} Fired;
+
+static TimerWheel wheel;
+static WheelTimer timers[TIMER_COUNT];
+static Expected expected[TIMER_COUNT];
+static std::vector<Fired> firedLog;
+
+static bool logFired(void* arg) {
+  int id = (int)(intptr_t)arg;
+  Fired fired = { wheel.now(), id };
+  firedLog.push_back(fired);
+  expected[id].fired++;
+  return false;
+}
+
+static void tickFor(uint32_t ticks) {
+  for (uint32_t i = 0; i < ticks; i++) {
+    wheel.tick();
+    if (i % DEFER_EVERY == 0) {
+      wheel.runDeferred();
+    }
+  }
+  wheel.runDeferred();
+}
+
+static void testOneShots() {
+  std::mt19937 random32(39);
+  firedLog.clear();
+  //odd ids run in the interrupt, delay 0 is due on the next tick
+  for (int i = 0; i < TIMER_COUNT; i++) {
+    uint16_t delay = i % 7 == 0 ? 0 : 1 + random32() % 3000;
+    expected[i].due = wheel.now() + max(delay, 1);
+    expected[i].cancelled = false;
+    expected[i].fired = 0;
+    wheel.in(&timers[i], delay, logFired, (void*)(intptr_t)i, (i & 1) ? WHEEL_TIMER_IN_ISR : 0);
+  }
+  for (int i = 0; i < TIMER_COUNT; i += 3) {
+    wheel.cancel(&timers[i]);
+    expected[i].cancelled = true;
+  }
+  //rearming an active timer moves it, it fires once at the new time
+  for (int i = 1; i < TIMER_COUNT; i += 11) {
+    if (wheel.active(&timers[i])) {
+      uint16_t delay = 1 + random32() % 3000;
+      expected[i].due = wheel.now() + delay;
+      wheel.in(&timers[i], delay, logFired, (void*)(intptr_t)i, (i & 1) ? WHEEL_TIMER_IN_ISR : 0);
+    }
+  }
+  tickFor(100);
+  for (int i = 0; i < TIMER_COUNT; i += 9) {
+    if (wheel.active(&timers[i])) {
+      wheel.cancel(&timers[i]);
+      expected[i].cancelled = true;
+    }
+  }
+  tickFor(3200);
+
+  uint32_t last = 0;
+  for (const Fired& fired : firedLog) {
+    const Expected& timer = expected[fired.id];
+    CHECK(!timer.cancelled);
+    if (fired.id & 1) {
+      //in the interrupt on the tick it is due
+      CHECK(fired.tick == timer.due);
+    } else {
+      //deferred ones wait for the next runDeferred()
+      CHECK(fired.tick >= timer.due && fired.tick <= timer.due + DEFER_EVERY);
+    }
+    CHECK(fired.tick >= last);
+    last = fired.tick;
+  }
+  int cancelled = 0;
+  for (int i = 0; i < TIMER_COUNT; i++) {
+    CHECK(expected[i].fired == (expected[i].cancelled ? 0 : 1));
+    CHECK(!wheel.active(&timers[i]));
+    cancelled += expected[i].cancelled;
+  }
+  printf("%u timers fired, %d cancelled, last on tick %lu\n", (unsigned)firedLog.size(), cancelled, (unsigned long)last);
+}
+
+static uint16_t repeatsLeft;
+static std::vector<uint32_t> repeatTicks;
+
+static bool repeat(void* arg) {
+  repeatTicks.push_back(wheel.now());
+  return --repeatsLeft > 0;
+}
+
+//a callback returning true runs again an interval later, until it returns false
+static void testRepeating() {
+  WheelTimer timer = {};
+  for (uint8_t flags = 0; flags <= WHEEL_TIMER_IN_ISR; flags++) {
+    repeatsLeft = 10;
+    repeatTicks.clear();
+    uint32_t start = wheel.now();
+    wheel.in(&timer, 37, repeat, NULL, flags);
+    tickFor(600);
+    CHECK(repeatTicks.size() == 10);
+    CHECK(!wheel.active(&timer));
+    for (size_t i = 0; i < repeatTicks.size(); i++) {
+      uint32_t since = repeatTicks[i] - (i ? repeatTicks[i - 1] : start);
+      if (flags & WHEEL_TIMER_IN_ISR) {
+        CHECK(since == 37);
+      } else {
+        CHECK(since >= 37 && since <= 37 + DEFER_EVERY);
+      }
+    }
+  }
+}
+
+static WheelTimer victim;
+static WheelTimer child;
+static bool victimFired;
+static bool childFired;
+
+static bool victimCallback(void* arg) {
+  victimFired = true;
+  return false;
+}
+
+static bool childCallback(void* arg) {
+  childFired = true;
+  return false;
+}
+
+//callbacks may cancel a timer due on the same tick and add new ones
+static bool parentCallback(void* arg) {
+  wheel.cancel(&victim);
+  wheel.in(&child, 0, childCallback, NULL, WHEEL_TIMER_IN_ISR);
+  return false;
+}
+
+static void testCallbackChanges() {
+  WheelTimer parent = {};
+  victimFired = false;
+  childFired = false;
+  wheel.in(&parent, 20, parentCallback, NULL, WHEEL_TIMER_IN_ISR);
+  wheel.in(&victim, 20, victimCallback, NULL, WHEEL_TIMER_IN_ISR);
+  for (uint8_t i = 0; i < 20; i++) {
+    wheel.tick();
+  }
+  CHECK(!victimFired && !childFired && wheel.active(&child));
+  wheel.tick();
+  CHECK(childFired && !wheel.active(&child));
+}
+
+int main() {
+  testOneShots();
+  testRepeating();
+  testCallbackChanges();
+  return checkResult();
+}
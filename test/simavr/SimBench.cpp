@@ -0,0 +1,491 @@
+#include "Check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_io.h>
+#include <avr_ioport.h>
+#include <avr_adc.h>
+#include <avr_usb.h>
+}
+
+//the ATmega32U4 image as the IDE builds it, run under simavr against a scripted host: button edges,
+//ADC voltages, serial lines and HID OUT reports through simavr's USB endpoints. every instruction is
+//stepped and the cycles of each loop(), Timer3 interrupt and Joystick_::sendState() counted, interrupts
+//that land inside loop() or sendState() are taken out of theirs. the image and the script are fixed so
+//the counts are the same on every run, a mean or max past the baseline by more than its threshold fails
+//  SimBench firmware.elf stimulus baseline [--record]
+
+#define CPU_HZ 16000000UL
+#define CYCLES_PER_MS (CPU_HZ / 1000)
+#define SERVICE_CYCLES (CYCLES_PER_MS / 4)  //the host polls the IN endpoints every 250us
+#define VECTOR_SIZE 4                       //a jmp per vector on the 32U4
+#define VECTOR_COUNT 43
+#define TIMER3_COMPA_VECTOR 32
+#define USB_PACKET_SIZE 64
+#define CDC_OUT_ENDPOINT 2
+#define HID_IN_ENDPOINT 4  //the first endpoint after the core's CDC ones, DynamicHID's OUT follows it
+#define HID_OUT_ENDPOINT 5
+
+static const uint8_t inEndpoints[] = { 1, 3, HID_IN_ENDPOINT };  //CDC notifications, CDC IN, HID IN
+
+typedef struct {
+  const char* name;
+  const char* symbol;  //as avr-nm lists it, NULL for the Timer3 vector
+  uint32_t address;    //byte address of the first instruction
+  bool active;
+  uint16_t entrySp;  //after the call pushed its return address
+  uint64_t start;
+  uint64_t interruptsAtStart;
+  uint64_t count;
+  uint64_t total;
+  uint64_t least;
+  uint64_t most;
+} Probe;
+
+#define PROBE_LOOP 0
+#define PROBE_TIMER3 1
+#define PROBE_SEND_STATE 2
+
+static Probe probes[] = {
+  { "loop", "loop" },
+  { "timer3", NULL },
+  { "sendState", "_ZN9Joystick_9sendStateEv" },
+};
+#define PROBE_COUNT (sizeof(probes) / sizeof(probes[0]))
+
+typedef struct {
+  uint16_t sp;
+  uint64_t start;
+  uint8_t vector;
+} InterruptFrame;
+
+static std::vector<InterruptFrame> interrupts;
+static uint64_t interruptCycles = 0;  //in outermost interrupts, since reset
+
+#define TRANSFER_SETUP 0
+#define TRANSFER_DATA 1
+#define TRANSFER_STATUS 2
+
+//endpoint 0 is a control transfer of setup, data and status, others OUT data in packets
+typedef struct {
+  uint8_t endpoint;
+  uint8_t setup[8];
+  std::vector<uint8_t> data;
+  uint8_t stage;
+  size_t offset;
+} Transfer;
+
+static std::deque<Transfer> transfers;
+static uint64_t usbInBytes[HID_IN_ENDPOINT + 1];
+
+typedef struct {
+  uint64_t at;  //cycle
+  std::string action;
+  std::string text;  //the rest of the line
+} Stimulus;
+
+static void fail(const char* message, const char* detail) {
+  printf("%s %s\n", message, detail);
+  exit(1);
+}
+
+static void record(Probe& probe, uint64_t cycles) {
+  if (probe.count == 0 || cycles < probe.least) {
+    probe.least = cycles;
+  }
+  if (cycles > probe.most) {
+    probe.most = cycles;
+  }
+  probe.total += cycles;
+  probe.count++;
+}
+
+static uint16_t stackPointer(avr_t* avr) {
+  return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+//one instruction, and an interrupt if one was taken after it
+static void step(avr_t* avr) {
+  int state = avr_run(avr);
+  if (state == cpu_Done || state == cpu_Crashed) {
+    fail("the image stopped", state == cpu_Crashed ? "crashed" : "done");
+  }
+  uint16_t sp = stackPointer(avr);
+  uint64_t now = avr->cycle;
+
+  //ret and reti pop the address pushed on entry, the stack is above it again
+  while (!interrupts.empty() && sp > interrupts.back().sp) {
+    InterruptFrame frame = interrupts.back();
+    interrupts.pop_back();
+    if (interrupts.empty()) {
+      interruptCycles += now - frame.start;
+    }
+    if (frame.vector == TIMER3_COMPA_VECTOR) {
+      record(probes[PROBE_TIMER3], now - frame.start);
+    }
+  }
+  for (Probe& probe : probes) {
+    if (probe.active && sp > probe.entrySp) {
+      probe.active = false;
+      record(probe, now - probe.start - (interruptCycles - probe.interruptsAtStart));
+    }
+  }
+
+  uint32_t pc = avr->pc;
+  if (pc != 0 && pc < VECTOR_COUNT * VECTOR_SIZE) {
+    InterruptFrame frame = { sp, now, (uint8_t)(pc / VECTOR_SIZE) };
+    interrupts.push_back(frame);
+  }
+  //only calls from loop() are counted, not ones made inside an interrupt
+  for (Probe& probe : probes) {
+    if (probe.symbol && !probe.active && interrupts.empty() && pc == probe.address) {
+      probe.active = true;
+      probe.entrySp = sp;
+      probe.start = now;
+      probe.interruptsAtStart = interruptCycles;
+    }
+  }
+}
+
+#define USB_OK 0
+#define USB_NAK 1
+
+static int usbIoctl(avr_t* avr, uint32_t request, uint8_t endpoint, uint8_t* buffer, uint32_t* size) {
+  avr_io_usb packet = { endpoint, *size, buffer };
+  int result = avr_ioctl(avr, request, &packet);
+  if ((uint32_t)result == (uint32_t)AVR_IOCTL_USB_NAK) {
+    return USB_NAK;
+  }
+  if (result != 0) {
+    char detail[32];
+    snprintf(detail, sizeof(detail), "endpoint %u", endpoint);
+    fail("USB stall on", detail);
+  }
+  *size = packet.sz;
+  return USB_OK;
+}
+
+//as far as the device takes it, true once the transfer is over
+static bool advance(avr_t* avr, Transfer& transfer) {
+  uint8_t buffer[USB_PACKET_SIZE];
+  if (transfer.endpoint != 0) {
+    while (transfer.offset < transfer.data.size()) {
+      uint32_t size = std::min(transfer.data.size() - transfer.offset, (size_t)USB_PACKET_SIZE);
+      if (usbIoctl(avr, AVR_IOCTL_USB_WRITE, transfer.endpoint, &transfer.data[transfer.offset], &size) == USB_NAK) {
+        return false;
+      }
+      transfer.offset += size;
+    }
+    return true;
+  }
+
+  bool toHost = transfer.setup[0] & 0x80;
+  uint16_t length = transfer.setup[6] | (transfer.setup[7] << 8);
+  for (;;) {
+    uint32_t size;
+    switch (transfer.stage) {
+      case TRANSFER_SETUP:
+        size = sizeof(transfer.setup);
+        if (usbIoctl(avr, AVR_IOCTL_USB_SETUP, 0, transfer.setup, &size) == USB_NAK) {
+          return false;
+        }
+        transfer.stage = length ? TRANSFER_DATA : TRANSFER_STATUS;
+        break;
+      case TRANSFER_DATA:
+        if (toHost) {
+          size = sizeof(buffer);
+          if (usbIoctl(avr, AVR_IOCTL_USB_READ, 0, buffer, &size) == USB_NAK) {
+            return false;
+          }
+          transfer.offset += size;
+          if (size < USB_PACKET_SIZE || transfer.offset >= length) {
+            transfer.stage = TRANSFER_STATUS;
+          }
+        } else {
+          size = std::min((size_t)length - transfer.offset, (size_t)USB_PACKET_SIZE);
+          if (usbIoctl(avr, AVR_IOCTL_USB_WRITE, 0, &transfer.data[transfer.offset], &size) == USB_NAK) {
+            return false;
+          }
+          transfer.offset += size;
+          if (transfer.offset >= length) {
+            transfer.stage = TRANSFER_STATUS;
+          }
+        }
+        break;
+      default:
+        //a zero length packet the other way
+        size = 0;
+        if (usbIoctl(avr, toHost ? AVR_IOCTL_USB_WRITE : AVR_IOCTL_USB_READ, 0, buffer, &size) == USB_NAK) {
+          return false;
+        }
+        return true;
+    }
+  }
+}
+
+static void service(avr_t* avr) {
+  //IN endpoints are read until they are empty, like a host polling every frame
+  uint8_t buffer[USB_PACKET_SIZE];
+  for (uint8_t endpoint : inEndpoints) {
+    uint32_t size = sizeof(buffer);
+    while (usbIoctl(avr, AVR_IOCTL_USB_READ, endpoint, buffer, &size) == USB_OK && size > 0) {
+      usbInBytes[endpoint] += size;
+      size = sizeof(buffer);
+    }
+  }
+  while (!transfers.empty() && advance(avr, transfers.front())) {
+    transfers.pop_front();
+  }
+}
+
+static std::vector<uint8_t> hexBytes(const char* text) {
+  std::vector<uint8_t> bytes;
+  char* end;
+  for (unsigned long value = strtoul(text, &end, 16); end != text; value = strtoul(text, &end, 16)) {
+    bytes.push_back(value);
+    text = end;
+  }
+  return bytes;
+}
+
+static void apply(avr_t* avr, const Stimulus& stimulus) {
+  const char* text = stimulus.text.c_str();
+  if (stimulus.action == "vbus") {
+    avr_ioctl(avr, AVR_IOCTL_USB_VBUS, (void*)1);
+  } else if (stimulus.action == "reset") {
+    avr_ioctl(avr, AVR_IOCTL_USB_RESET, NULL);
+  } else if (stimulus.action == "pin") {
+    char port;
+    unsigned bit, level;
+    if (sscanf(text, " %c%u %u", &port, &bit, &level) != 3) {
+      fail("bad pin", text);
+    }
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), bit), level);
+  } else if (stimulus.action == "adc") {
+    unsigned channel, millivolts;
+    if (sscanf(text, "%u %u", &channel, &millivolts) != 2) {
+      fail("bad adc", text);
+    }
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + channel), millivolts);
+  } else {
+    Transfer transfer = {};
+    if (stimulus.action == "setup") {
+      std::vector<uint8_t> bytes = hexBytes(text);
+      if (bytes.size() < sizeof(transfer.setup)) {
+        fail("bad setup", text);
+      }
+      memcpy(transfer.setup, bytes.data(), sizeof(transfer.setup));
+      transfer.data.assign(bytes.begin() + sizeof(transfer.setup), bytes.end());
+      //host to device data has to be all there
+      if (!(transfer.setup[0] & 0x80) && transfer.data.size() < (size_t)(transfer.setup[6] | (transfer.setup[7] << 8))) {
+        fail("short setup data", text);
+      }
+    } else if (stimulus.action == "serial") {
+      transfer.endpoint = CDC_OUT_ENDPOINT;
+      while (*text == ' ') {
+        text++;
+      }
+      transfer.data.assign(text, text + strlen(text));
+    } else if (stimulus.action == "hid") {
+      transfer.endpoint = HID_OUT_ENDPOINT;
+      transfer.data = hexBytes(text);
+    } else {
+      fail("unknown action", stimulus.action.c_str());
+    }
+    transfers.push_back(transfer);
+  }
+}
+
+//time in ms, action and its arguments per line, # starts a comment
+static std::vector<Stimulus> readStimulus(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    fail("can't read", path);
+  }
+  std::vector<Stimulus> stimuli;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "#\r\n")] = '\0';
+    double ms;
+    char action[16];
+    int used;
+    if (sscanf(line, "%lf %15s%n", &ms, action, &used) != 2) {
+      continue;
+    }
+    Stimulus stimulus = { (uint64_t)(ms * CYCLES_PER_MS), action, line + used };
+    if (!stimuli.empty() && stimulus.at < stimuli.back().at) {
+      fail("out of order", line);
+    }
+    stimuli.push_back(stimulus);
+  }
+  fclose(file);
+  return stimuli;
+}
+
+static void findSymbols(const char* elf) {
+  std::string command = std::string(AVR_NM) + " " + elf;
+  FILE* nm = popen(command.c_str(), "r");
+  if (!nm) {
+    fail("can't run", command.c_str());
+  }
+  char line[512];
+  while (fgets(line, sizeof(line), nm)) {
+    unsigned long address;
+    char type;
+    char name[400];
+    if (sscanf(line, "%lx %c %399s", &address, &type, name) != 3) {
+      continue;
+    }
+    for (Probe& probe : probes) {
+      if (probe.symbol && strcmp(probe.symbol, name) == 0) {
+        probe.address = address;
+      }
+    }
+  }
+  pclose(nm);
+  for (Probe& probe : probes) {
+    if (probe.symbol && !probe.address) {
+      fail("not in the image, inlined?", probe.symbol);
+    }
+  }
+}
+
+typedef struct {
+  bool recorded;
+  uint64_t mean;
+  uint64_t most;
+} Baseline;
+
+static unsigned threshold = 10;  //percent
+static Baseline baselines[PROBE_COUNT];
+
+static void readBaseline(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    return;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    char name[32];
+    unsigned long long mean, most;
+    if (line[0] == '#') {
+      continue;
+    }
+    if (sscanf(line, "threshold %u", &threshold) == 1) {
+      continue;
+    }
+    for (uint8_t p = 0; p < PROBE_COUNT; p++) {
+      if (sscanf(line, "%31s %llu %llu", name, &mean, &most) == 3 && strcmp(name, probes[p].name) == 0) {
+        baselines[p].recorded = true;
+        baselines[p].mean = mean;
+        baselines[p].most = most;
+      }
+    }
+  }
+  fclose(file);
+}
+
+static void writeBaseline(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    fail("can't write", path);
+  }
+  fprintf(file, "# SimBench cycles per call, mean and max, of the image built from this tree under bench.stim.\n");
+  fprintf(file, "# rewritten by SimBench --record, a count past its line by more than threshold percent fails\n");
+  fprintf(file, "threshold %u\n", threshold);
+  for (const Probe& probe : probes) {
+    fprintf(file, "%s %llu %llu\n", probe.name, (unsigned long long)(probe.total / probe.count), (unsigned long long)probe.most);
+  }
+  fclose(file);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    fail("usage:", "SimBench firmware.elf stimulus baseline [--record]");
+  }
+  bool recording = argc > 4 && strcmp(argv[4], "--record") == 0;
+  findSymbols(argv[1]);
+  std::vector<Stimulus> stimuli = readStimulus(argv[2]);
+  readBaseline(argv[3]);
+
+  elf_firmware_t firmware = {};
+  if (elf_read_firmware(argv[1], &firmware) != 0) {
+    fail("can't load", argv[1]);
+  }
+  //the IDE's image carries no .mmcu section
+  strcpy(firmware.mmcu, "atmega32u4");
+  firmware.frequency = CPU_HZ;
+  avr_t* avr = avr_make_mcu_by_name(firmware.mmcu);
+  if (!avr) {
+    fail("simavr has no", firmware.mmcu);
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->vcc = avr->avcc = avr->aref = 5000;
+
+  size_t next = 0;
+  bool ended = false;
+  uint64_t nextService = SERVICE_CYCLES;
+  while (!ended) {
+    while (next < stimuli.size() && avr->cycle >= stimuli[next].at) {
+      ended |= stimuli[next].action == "end";
+      if (!ended) {
+        apply(avr, stimuli[next]);
+      }
+      next++;
+    }
+    if (next == stimuli.size() && !ended) {
+      fail("the stimulus has no", "end");
+    }
+    step(avr);
+    if (avr->cycle >= nextService) {
+      service(avr);
+      nextService += SERVICE_CYCLES;
+    }
+  }
+  //every host transfer went in, and the device answered over HID
+  CHECK(transfers.empty());
+  CHECK(usbInBytes[HID_IN_ENDPOINT] > 0);
+
+  printf("%llu ms simulated, %llu bytes read over HID and %llu over CDC\n", (unsigned long long)(avr->cycle / CYCLES_PER_MS),
+         (unsigned long long)usbInBytes[HID_IN_ENDPOINT], (unsigned long long)usbInBytes[3]);
+  printf("%-10s %8s %8s %8s %8s %14s\n", "cycles", "calls", "min", "mean", "max", "baseline");
+  for (uint8_t p = 0; p < PROBE_COUNT; p++) {
+    const Probe& probe = probes[p];
+    const Baseline& baseline = baselines[p];
+    if (probe.count == 0) {
+      printf("%s never ran\n", probe.name);
+      checkFailures++;
+      continue;
+    }
+    uint64_t mean = probe.total / probe.count;
+    printf("%-10s %8llu %8llu %8llu %8llu", probe.name, (unsigned long long)probe.count, (unsigned long long)probe.least,
+           (unsigned long long)mean, (unsigned long long)probe.most);
+    if (baseline.recorded) {
+      printf(" %6llu %7llu\n", (unsigned long long)baseline.mean, (unsigned long long)baseline.most);
+    } else {
+      printf(" %14s\n", "none");
+    }
+    if (recording) {
+      continue;
+    }
+    if (!baseline.recorded) {
+      printf("%s has no baseline, record one with --record\n", probe.name);
+      checkFailures++;
+    } else if (mean * 100 > baseline.mean * (100 + threshold) || probe.most * 100 > baseline.most * (100 + threshold)) {
+      printf("%s is past its baseline by more than %u%%\n", probe.name, threshold);
+      checkFailures++;
+    }
+  }
+  if (recording && !checkFailures) {
+    writeBaseline(argv[3]);
+  }
+  return checkResult();
+}
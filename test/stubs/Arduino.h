@@ -0,0 +1,106 @@
+#ifndef ARDUINO_h
+#define ARDUINO_h
+
+//host stand-in for the AVR core, only what the sketch uses.
+//pins, the clock, USB and the EEPROM are recorded and scripted through Host.h
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define A0 18
+#define A1 19
+#define A2 20
+#define A3 21
+#define A4 22
+#define A5 23
+
+#define NUM_DIGITAL_PINS 31
+
+//binary.h, the ones the sketch uses
+#define B00000001 1
+#define B00000010 2
+#define B00000100 4
+#define B00001000 8
+#define B00001111 15
+#define B00010000 16
+#define B00100000 32
+
+//the AVR core has macros, templates keep them out of the way of the standard headers the tests use.
+//by value like the macros, a reference can't bind to a packed field
+template<class T, class L>
+auto min(T a, L b) -> typename std::decay<decltype((b < a) ? b : a)>::type {
+  return (b < a) ? b : a;
+}
+template<class T, class L>
+auto max(T a, L b) -> typename std::decay<decltype((b < a) ? b : a)>::type {
+  return (a < b) ? b : a;
+}
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define lowByte(w) ((uint8_t)((w)&0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+
+#define interrupts() sei()
+#define noInterrupts() cli()
+
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+class Stream {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual size_t write(uint8_t c) = 0;
+  size_t write(const uint8_t* buffer, size_t size);
+  size_t print(const char* s);
+  size_t print(long n);
+  size_t println(const char* s);
+  size_t println(long n);
+  size_t println(void);
+};
+
+class Serial_ : public Stream {
+public:
+  void begin(unsigned long baud);
+  virtual int available();
+  virtual int read();
+  virtual int peek();
+  virtual size_t write(uint8_t c);
+  using Stream::write;
+};
+extern Serial_ Serial;
+
+#include "USBAPI.h"
+
+#endif  // ARDUINO_h
@@ -0,0 +1,360 @@
+#include "Host.h"
+#include <deque>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "SerialParser.h"
+#include "PluggableUSB.h"
+
+extern "C" void EE_READY_vect(void);
+
+volatile uint8_t SREG;
+volatile uint16_t SP = RAMEND;
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint16_t TCNT1;
+volatile uint16_t OCR1A;
+volatile uint8_t TIMSK1;
+volatile uint8_t TIFR1;
+volatile uint8_t TCCR3A;
+volatile uint8_t TCCR3B;
+volatile uint16_t TCNT3;
+volatile uint16_t OCR3A;
+volatile uint8_t TIMSK3;
+volatile uint8_t TIFR3;
+volatile uint8_t EECR;
+volatile uint8_t UDFNUML;
+volatile uint8_t UDFNUMH;
+
+std::vector<HostPinWrite> hostPinWrites;
+std::vector<HostTransfer> hostUsbSent;
+std::vector<HostTransfer> hostControlSent;
+std::string hostSerialOut;
+bool hostRecording = true;
+unsigned long hostUsbSentCount = 0;
+
+uint8_t hostEeprom[E2END + 1];
+long hostEepromWriteBudget = -1;
+unsigned long hostEepromWrites = 0;
+unsigned long hostEepromWear[E2END + 1];
+unsigned long hostEepromReads = 0;
+
+static uint32_t hostMicros = 0;
+static uint8_t pinLevels[NUM_DIGITAL_PINS];
+static int analogValues[NUM_DIGITAL_PINS];
+static std::deque<uint8_t> serialIn;
+static std::deque<std::vector<uint8_t> > usbOut;
+static std::vector<uint8_t> controlOut;
+
+static struct HostInit {
+  HostInit() {
+    hostEepromErase();
+    hostReset();
+  }
+} hostInit;
+
+void hostReset() {
+  hostPinWrites.clear();
+  hostUsbSent.clear();
+  hostControlSent.clear();
+  hostSerialOut.clear();
+  hostUsbSentCount = 0;
+  serialIn.clear();
+  usbOut.clear();
+  controlOut.clear();
+  //buttons sit on pull-ups, released reads high
+  memset(pinLevels, HIGH, sizeof(pinLevels));
+  memset(analogValues, 0, sizeof(analogValues));
+}
+
+void hostAdvance(unsigned long us) {
+  hostMicros += us;
+  uint16_t frame = (hostMicros / 1000) & 0x7FF;
+  UDFNUML = lowByte(frame);
+  UDFNUMH = highByte(frame);
+  //Timer3 counts 0.5us ticks up to OCR3A = 399
+  TCNT3 = (hostMicros % 200) * 2;
+}
+
+void hostSetPin(uint8_t pin, uint8_t level) {
+  pinLevels[pin] = level;
+}
+
+void hostSetAnalog(uint8_t pin, int value) {
+  analogValues[pin] = value;
+}
+
+void hostSerialIn(const void* data, size_t length) {
+  serialIn.insert(serialIn.end(), (const uint8_t*)data, (const uint8_t*)data + length);
+}
+
+void hostSerialIn(const char* text) {
+  hostSerialIn(text, strlen(text));
+}
+
+void hostSerialFrame(const void* payload, uint8_t length) {
+  uint8_t crc = _crc8_ccitt_update(0, length);
+  for (uint8_t i = 0; i < length; i++) {
+    crc = _crc8_ccitt_update(crc, ((const uint8_t*)payload)[i]);
+  }
+  uint8_t header[2] = { SERIAL_FRAME_SYNC, length };
+  hostSerialIn(header, sizeof(header));
+  hostSerialIn(payload, length);
+  hostSerialIn(&crc, 1);
+}
+
+size_t hostSerialPending() {
+  return serialIn.size();
+}
+
+void hostUsbOut(const void* report, size_t length) {
+  usbOut.push_back(std::vector<uint8_t>((const uint8_t*)report, (const uint8_t*)report + length));
+}
+
+void hostControlOut(const void* data, size_t length) {
+  controlOut.assign((const uint8_t*)data, (const uint8_t*)data + length);
+}
+
+bool hostControl(uint8_t requestType, uint8_t request, uint8_t valueL, uint8_t valueH, uint16_t index, uint16_t length) {
+  USBSetup setup = { requestType, request, valueL, valueH, index, length };
+  return PluggableUSB().setup(setup);
+}
+
+void hostEepromErase() {
+  memset(hostEeprom, 0xFF, sizeof(hostEeprom));
+}
+
+void hostEepromFinish() {
+  while (EECR & (1 << EERIE)) {
+    EE_READY_vect();
+  }
+}
+
+//Arduino core
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+unsigned long millis(void) {
+  return hostMicros / 1000;
+}
+
+unsigned long micros(void) {
+  return hostMicros;
+}
+
+void delay(unsigned long ms) {
+  hostAdvance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  hostAdvance(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (hostRecording) {
+    HostPinWrite write = { hostMicros, pin, val };
+    hostPinWrites.push_back(write);
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return pinLevels[pin];
+}
+
+int analogReadFast(byte ADCpin, byte prescalerBits) {
+  return analogValues[ADCpin];
+}
+
+size_t Stream::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    write(buffer[i]);
+  }
+  return size;
+}
+
+size_t Stream::print(const char* s) {
+  return write((const uint8_t*)s, strlen(s));
+}
+
+size_t Stream::print(long n) {
+  char text[12];
+  snprintf(text, sizeof(text), "%ld", n);
+  return print(text);
+}
+
+size_t Stream::println(const char* s) {
+  return print(s) + println();
+}
+
+size_t Stream::println(long n) {
+  return print(n) + println();
+}
+
+size_t Stream::println(void) {
+  return print("\r\n");
+}
+
+Serial_ Serial;
+
+void Serial_::begin(unsigned long baud) {
+}
+
+int Serial_::available() {
+  return serialIn.size();
+}
+
+int Serial_::read() {
+  if (serialIn.empty()) {
+    return -1;
+  }
+  uint8_t c = serialIn.front();
+  serialIn.pop_front();
+  return c;
+}
+
+int Serial_::peek() {
+  return serialIn.empty() ? -1 : serialIn.front();
+}
+
+size_t Serial_::write(uint8_t c) {
+  hostSerialOut += (char)c;
+  return 1;
+}
+
+//EEPROM, a write past the budget is lost like on a power cut
+
+uint8_t eeprom_read_byte(const uint8_t* address) {
+  hostEepromReads++;
+  return hostEeprom[(uintptr_t)address];
+}
+
+void eeprom_write_byte(uint8_t* address, uint8_t value) {
+  if (hostEepromWriteBudget < 0 || (long)hostEepromWrites < hostEepromWriteBudget) {
+    hostEeprom[(uintptr_t)address] = value;
+    hostEepromWear[(uintptr_t)address]++;
+  }
+  hostEepromWrites++;
+}
+
+//USB
+
+static void record(std::vector<HostTransfer>& transfers, uint8_t ep, uint8_t flags, const void* data, int len) {
+  if (hostRecording) {
+    HostTransfer transfer = { hostMicros, ep, flags, std::vector<uint8_t>((const uint8_t*)data, (const uint8_t*)data + len) };
+    transfers.push_back(transfer);
+  }
+}
+
+int USB_SendControl(uint8_t flags, const void* d, int len) {
+  record(hostControlSent, 0, flags, d, len);
+  return len;
+}
+
+int USB_RecvControl(void* d, int len) {
+  int length = min((size_t)len, controlOut.size());
+  memcpy(d, controlOut.data(), length);
+  controlOut.clear();
+  return length;
+}
+
+uint8_t USB_Available(uint8_t ep) {
+  return usbOut.empty() ? 0 : usbOut.front().size();
+}
+
+int USB_Send(uint8_t ep, const void* data, int len) {
+  hostUsbSentCount++;
+  record(hostUsbSent, ep & 0x07, ep & 0xF0, data, len);
+  return len;
+}
+
+int USB_Recv(uint8_t ep, void* data, int len) {
+  if (usbOut.empty()) {
+    return -1;
+  }
+  int length = min((size_t)len, usbOut.front().size());
+  memcpy(data, usbOut.front().data(), length);
+  usbOut.pop_front();
+  return length;
+}
+
+int USB_Recv(uint8_t ep) {
+  if (usbOut.empty()) {
+    return -1;
+  }
+  uint8_t c = usbOut.front().front();
+  usbOut.front().erase(usbOut.front().begin());
+  if (usbOut.front().empty()) {
+    usbOut.pop_front();
+  }
+  return c;
+}
+
+//PluggableUSB, the CDC serial port takes interfaces 0 and 1 and endpoints 1 to 3
+
+PluggableUSB_& PluggableUSB() {
+  static PluggableUSB_ obj;
+  return obj;
+}
+
+PluggableUSB_::PluggableUSB_()
+  : lastIf(2), lastEp(4), rootNode(NULL) {
+}
+
+bool PluggableUSB_::plug(PluggableUSBModule* node) {
+  if (!rootNode) {
+    rootNode = node;
+  } else {
+    PluggableUSBModule* current = rootNode;
+    while (current->next) {
+      current = current->next;
+    }
+    current->next = node;
+  }
+  node->pluggedInterface = lastIf;
+  node->pluggedEndpoint = lastEp;
+  lastIf += node->numInterfaces;
+  lastEp += node->numEndpoints;
+  return true;
+}
+
+int PluggableUSB_::getInterface(uint8_t* interfaceCount) {
+  int sent = 0;
+  for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+    int res = node->getInterface(interfaceCount);
+    if (res < 0) {
+      return -1;
+    }
+    sent += res;
+  }
+  return sent;
+}
+
+int PluggableUSB_::getDescriptor(USBSetup& setup) {
+  for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+    int ret = node->getDescriptor(setup);
+    if (ret) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+void PluggableUSB_::getShortName(char* iSerialNum) {
+  for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+    iSerialNum += node->getShortName(iSerialNum);
+  }
+  *iSerialNum = 0;
+}
+
+bool PluggableUSB_::setup(USBSetup& setup) {
+  for (PluggableUSBModule* node = rootNode; node; node = node->next) {
+    if (node->setup(setup)) {
+      return true;
+    }
+  }
+  return false;
+}
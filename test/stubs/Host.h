@@ -0,0 +1,62 @@
+#ifndef HOST_h
+#define HOST_h
+
+//the host side of the stubs: a clock tests move by hand, the inputs they script
+//and a record of what the sketch wrote to pins, USB and Serial
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+
+//these hold library types, they keep the host's alignment (HostLayout.h)
+#pragma pack(push)
+#pragma pack()
+
+typedef struct {
+  unsigned long time;
+  uint8_t pin;
+  uint8_t value;
+} HostPinWrite;
+
+typedef struct {
+  unsigned long time;
+  uint8_t ep;     //endpoint, 0 for control transfers
+  uint8_t flags;  //TRANSFER_* flags passed along with it
+  std::vector<uint8_t> data;
+} HostTransfer;
+
+#pragma pack(pop)
+
+extern std::vector<HostPinWrite> hostPinWrites;
+extern std::vector<HostTransfer> hostUsbSent;      //USB_Send, reports to the host
+extern std::vector<HostTransfer> hostControlSent;  //USB_SendControl, descriptors and feature reports
+extern std::string hostSerialOut;
+extern bool hostRecording;  //false keeps benchmarks from filling the records, the counts still go up
+extern unsigned long hostUsbSentCount;
+
+extern uint8_t hostEeprom[E2END + 1];
+extern long hostEepromWriteBudget;  //bytes written before the power is cut, negative for no cut
+extern unsigned long hostEepromWrites;
+extern unsigned long hostEepromWear[E2END + 1];  //writes that reached each cell
+extern unsigned long hostEepromReads;
+
+void hostReset();  //clears the records and scripted input, the clock and the EEPROM stay
+void hostAdvance(unsigned long us);  //micros(), the USB frame number and TCNT3 move together
+
+void hostSetPin(uint8_t pin, uint8_t level);
+void hostSetAnalog(uint8_t pin, int value);
+
+void hostSerialIn(const void* data, size_t length);
+void hostSerialIn(const char* text);
+void hostSerialFrame(const void* payload, uint8_t length);  //SYNC, LEN, payload and CRC8
+size_t hostSerialPending();
+
+void hostUsbOut(const void* report, size_t length);    //read by the next USB_Recv
+void hostControlOut(const void* data, size_t length);  //data stage of the next control request
+bool hostControl(uint8_t requestType, uint8_t request, uint8_t valueL, uint8_t valueH, uint16_t index, uint16_t length);
+
+void hostEepromErase();
+void hostEepromFinish();  //EE_READY until the background writer is done
+
+#endif  // HOST_h
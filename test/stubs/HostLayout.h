@@ -0,0 +1,23 @@
+#ifndef HOSTLAYOUT_h
+#define HOSTLAYOUT_h
+
+//included ahead of every file of the host build.
+//the AVR aligns nothing, so every struct after this is packed and reports and EEPROM records keep their layout.
+//the C and C++ library headers come first and keep their own
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#pragma pack(1)
+
+#endif  // HOSTLAYOUT_h
@@ -0,0 +1,19 @@
+#include "MemoryMonitor.h"
+
+//MemoryMonitor.cpp reads the AVR heap and stack layout, there is nothing like it to measure on the host
+
+MemoryMonitor memoryMonitor;
+
+MemoryMonitor::MemoryMonitor() {
+  watermark = NULL;
+  scan = NULL;
+  largestVla = 0;
+}
+
+void MemoryMonitor::update() {
+}
+
+void MemoryMonitor::getStats(MemoryStats* stats) {
+  memset(stats, 0, sizeof(MemoryStats));
+  stats->largestVla = largestVla;
+}
@@ -0,0 +1,66 @@
+#include "InputDebounce.h"
+
+InputDebounce::InputDebounce(int8_t pinIn, unsigned long debDelay, PinInMode pinInMode)
+  : _pinIn(0), _debDelay(debDelay), _pinInMode(pinInMode), _enabled(false),
+    _valueLast(false), _stateOn(false), _timeStamp(0), _stateOnCount(0),
+    _pressedCallback(NULL), _releasedCallback(NULL),
+    _pressedDurationCallback(NULL), _releasedDurationCallback(NULL) {
+  setup(pinIn, debDelay, pinInMode);
+}
+
+void InputDebounce::setup(int8_t pinIn, unsigned long debDelay, PinInMode pinInMode) {
+  if (pinIn < 0) {
+    return;
+  }
+  _pinIn = pinIn;
+  _debDelay = debDelay;
+  _pinInMode = pinInMode;
+  _enabled = true;
+  _valueLast = false;
+  _stateOn = false;
+  _timeStamp = millis();
+}
+
+void InputDebounce::registerCallbacks(inputdebounce_state_cb pressedCallback, inputdebounce_state_cb releasedCallback,
+                                      inputdebounce_duration_cb pressedDurationCallback, inputdebounce_duration_cb releasedDurationCallback) {
+  _pressedCallback = pressedCallback;
+  _releasedCallback = releasedCallback;
+  _pressedDurationCallback = pressedDurationCallback;
+  _releasedDurationCallback = releasedDurationCallback;
+}
+
+//a new level has to hold for the debounce delay, then the state flips and the callbacks run
+unsigned long InputDebounce::process(unsigned long now) {
+  if (!_enabled) {
+    return 0;
+  }
+  bool value = digitalRead(_pinIn) == (_pinInMode == PIM_EXT_PULL_DOWN_RES ? HIGH : LOW);
+  if (value != _valueLast) {
+    _valueLast = value;
+    _timeStamp = now;
+  } else if (value != _stateOn && now - _timeStamp >= _debDelay) {
+    _stateOn = value;
+    _timeStamp = now;
+    if (_stateOn) {
+      _stateOnCount++;
+      if (_pressedCallback) {
+        _pressedCallback(_pinIn);
+      }
+    } else if (_releasedCallback) {
+      _releasedCallback(_pinIn);
+    }
+  }
+  if (value != _stateOn) {
+    return 0;
+  }
+  if (_stateOn) {
+    if (_pressedDurationCallback) {
+      _pressedDurationCallback(_pinIn, now - _timeStamp);
+    }
+    return now - _timeStamp;
+  }
+  if (_releasedDurationCallback) {
+    _releasedDurationCallback(_pinIn, now - _timeStamp);
+  }
+  return 0;
+}
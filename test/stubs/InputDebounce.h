@@ -0,0 +1,43 @@
+#ifndef InputDebounce_h
+#define InputDebounce_h
+
+//the library's interface, debouncing the levels tests set with hostSetPin()
+
+#include <Arduino.h>
+
+#define DEFAULT_INPUT_DEBOUNCE_DELAY 20
+
+typedef void (*inputdebounce_state_cb)(uint8_t);
+typedef void (*inputdebounce_duration_cb)(uint8_t, unsigned long);
+
+class InputDebounce {
+public:
+  enum PinInMode {
+    PIM_EXT_PULL_DOWN_RES,
+    PIM_EXT_PULL_UP_RES,
+    PIM_INT_PULL_UP_RES
+  };
+
+  InputDebounce(int8_t pinIn = -1, unsigned long debDelay = DEFAULT_INPUT_DEBOUNCE_DELAY, PinInMode pinInMode = PIM_INT_PULL_UP_RES);
+
+  void setup(int8_t pinIn, unsigned long debDelay = DEFAULT_INPUT_DEBOUNCE_DELAY, PinInMode pinInMode = PIM_INT_PULL_UP_RES);
+  unsigned long process(unsigned long now);
+  void registerCallbacks(inputdebounce_state_cb pressedCallback, inputdebounce_state_cb releasedCallback,
+                         inputdebounce_duration_cb pressedDurationCallback, inputdebounce_duration_cb releasedDurationCallback);
+
+private:
+  int8_t _pinIn;
+  unsigned long _debDelay;
+  PinInMode _pinInMode;
+  bool _enabled;
+  bool _valueLast;  //last level read, pressed is true
+  bool _stateOn;    //debounced state
+  unsigned long _timeStamp;
+  unsigned long _stateOnCount;
+  inputdebounce_state_cb _pressedCallback;
+  inputdebounce_state_cb _releasedCallback;
+  inputdebounce_duration_cb _pressedDurationCallback;
+  inputdebounce_duration_cb _releasedDurationCallback;
+};
+
+#endif  // InputDebounce_h
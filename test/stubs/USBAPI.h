@@ -0,0 +1,76 @@
+#ifndef USBAPI_h
+#define USBAPI_h
+
+//the core's USB device API, what goes over the bus is recorded in Host.cpp
+
+#include <stdint.h>
+
+#define CDC_ENABLED
+#define PLUGGABLE_USB_ENABLED
+
+#define USB_EP_SIZE 64
+#define TRANSFER_PGM 0x80
+#define TRANSFER_RELEASE 0x40
+#define TRANSFER_ZERO 0x20
+
+#define EP_TYPE_INTERRUPT_IN 0xC1
+#define EP_TYPE_INTERRUPT_OUT 0xC0
+
+#define REQUEST_HOSTTODEVICE 0x00
+#define REQUEST_DEVICETOHOST 0x80
+#define REQUEST_STANDARD 0x00
+#define REQUEST_CLASS 0x20
+#define REQUEST_INTERFACE 0x01
+#define REQUEST_DEVICETOHOST_CLASS_INTERFACE (REQUEST_DEVICETOHOST | REQUEST_CLASS | REQUEST_INTERFACE)
+#define REQUEST_HOSTTODEVICE_CLASS_INTERFACE (REQUEST_HOSTTODEVICE | REQUEST_CLASS | REQUEST_INTERFACE)
+#define REQUEST_DEVICETOHOST_STANDARD_INTERFACE (REQUEST_DEVICETOHOST | REQUEST_STANDARD | REQUEST_INTERFACE)
+
+#define USB_DEVICE_CLASS_HUMAN_INTERFACE 0x03
+#define USB_ENDPOINT_TYPE_INTERRUPT 0x03
+#define USB_ENDPOINT_OUT(addr) ((uint8_t)((addr) | 0x00))
+#define USB_ENDPOINT_IN(addr) ((uint8_t)((addr) | 0x80))
+
+typedef struct {
+  uint8_t bmRequestType;
+  uint8_t bRequest;
+  uint8_t wValueL;
+  uint8_t wValueH;
+  uint16_t wIndex;
+  uint16_t wLength;
+} USBSetup;
+
+typedef struct {
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t number;
+  uint8_t alternate;
+  uint8_t numEndpoints;
+  uint8_t interfaceClass;
+  uint8_t interfaceSubClass;
+  uint8_t protocol;
+  uint8_t iInterface;
+} __attribute__((packed)) InterfaceDescriptor;
+
+typedef struct {
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t addr;
+  uint8_t attr;
+  uint16_t packetSize;
+  uint8_t interval;
+} __attribute__((packed)) EndpointDescriptor;
+
+#define D_INTERFACE(_n, _numEndpoints, _class, _subClass, _protocol) \
+  { 9, 4, _n, 0, _numEndpoints, _class, _subClass, _protocol, 0 }
+
+#define D_ENDPOINT(_addr, _attr, _packetSize, _interval) \
+  { 7, 5, _addr, _attr, _packetSize, _interval }
+
+int USB_SendControl(uint8_t flags, const void* d, int len);
+int USB_RecvControl(void* d, int len);
+uint8_t USB_Available(uint8_t ep);
+int USB_Send(uint8_t ep, const void* data, int len);
+int USB_Recv(uint8_t ep, void* data, int len);
+int USB_Recv(uint8_t ep);
+
+#endif  // USBAPI_h
@@ -0,0 +1,9 @@
+#ifndef analogReadFast_H
+#define analogReadFast_H
+
+#include <Arduino.h>
+
+//the value set with hostSetAnalog()
+int analogReadFast(byte ADCpin, byte prescalerBits = 4);
+
+#endif  // analogReadFast_H
@@ -0,0 +1,11 @@
+#ifndef AVR_EEPROM_h
+#define AVR_EEPROM_h
+
+//backed by hostEeprom in Host.cpp, writes past hostEepromWriteBudget are lost like on a power cut
+
+#include <stdint.h>
+
+uint8_t eeprom_read_byte(const uint8_t* address);
+void eeprom_write_byte(uint8_t* address, uint8_t value);
+
+#endif  // AVR_EEPROM_h
@@ -0,0 +1,12 @@
+#ifndef AVR_INTERRUPT_h
+#define AVR_INTERRUPT_h
+
+#include <avr/io.h>
+
+//an ISR is a plain function on the host, tests call it where the interrupt would fire
+#define ISR(vector, ...) extern "C" void vector(void)
+
+#define cli() (SREG &= ~0x80)
+#define sei() (SREG |= 0x80)
+
+#endif  // AVR_INTERRUPT_h
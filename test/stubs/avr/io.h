@@ -0,0 +1,57 @@
+#ifndef AVR_IO_h
+#define AVR_IO_h
+
+//the ATmega32U4 registers the sketch touches, plain variables on the host (Host.cpp)
+
+#include <stdint.h>
+
+#define __AVR_ATmega32U4__
+#define USBCON
+
+extern volatile uint8_t SREG;
+extern volatile uint16_t SP;
+
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint16_t TCNT1;
+extern volatile uint16_t OCR1A;
+extern volatile uint8_t TIMSK1;
+extern volatile uint8_t TIFR1;
+
+extern volatile uint8_t TCCR3A;
+extern volatile uint8_t TCCR3B;
+extern volatile uint16_t TCNT3;
+extern volatile uint16_t OCR3A;
+extern volatile uint8_t TIMSK3;
+extern volatile uint8_t TIFR3;
+
+extern volatile uint8_t EECR;
+
+extern volatile uint8_t UDFNUML;
+extern volatile uint8_t UDFNUMH;
+
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define OCIE1A 1
+#define OCF1A 1
+
+#define CS30 0
+#define CS31 1
+#define CS32 2
+#define WGM32 3
+#define OCIE3A 1
+#define OCF3A 1
+
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+#define EERIE 3
+
+#define RAMEND 0x0AFF
+#define E2END 0x3FF
+
+#define _BV(bit) (1 << (bit))
+
+#endif  // AVR_IO_h
@@ -0,0 +1,21 @@
+#ifndef AVR_PGMSPACE_h
+#define AVR_PGMSPACE_h
+
+//flash and RAM share one address space on the host
+
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char*
+
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define strncmp_P strncmp
+
+#endif  // AVR_PGMSPACE_h
@@ -0,0 +1,10 @@
+#ifndef __digitalWriteFast_h_
+#define __digitalWriteFast_h_
+
+#include <Arduino.h>
+
+#define pinModeFast(pin, mode) pinMode(pin, mode)
+#define digitalWriteFast(pin, value) digitalWrite(pin, value)
+#define digitalReadFast(pin) digitalRead(pin)
+
+#endif  // __digitalWriteFast_h_
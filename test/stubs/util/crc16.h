@@ -0,0 +1,32 @@
+#ifndef UTIL_CRC16_h
+#define UTIL_CRC16_h
+
+//the C equivalents avr-libc documents for its inline assembly
+
+#include <stdint.h>
+
+inline uint16_t _crc16_update(uint16_t crc, uint8_t a) {
+  crc ^= a;
+  for (uint8_t i = 0; i < 8; ++i) {
+    if (crc & 1) {
+      crc = (crc >> 1) ^ 0xA001;
+    } else {
+      crc = (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data) {
+  crc ^= data;
+  for (uint8_t i = 0; i < 8; ++i) {
+    if (crc & 0x80) {
+      crc = (crc << 1) ^ 0x07;
+    } else {
+      crc <<= 1;
+    }
+  }
+  return crc;
+}
+
+#endif  // UTIL_CRC16_h
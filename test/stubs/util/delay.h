@@ -0,0 +1,10 @@
+#ifndef UTIL_DELAY_h
+#define UTIL_DELAY_h
+
+inline void _delay_us(double us) {
+}
+
+inline void _delay_ms(double ms) {
+}
+
+#endif  // UTIL_DELAY_h